@@ -0,0 +1,57 @@
+#include "CpuGovernor.h"
+#include "VoiceManager.h"
+#include "reverb.h"
+
+CpuGovernor cpuGovernor;
+
+void CpuGovernor::Update(const uint32_t time)
+{
+	renderTime = time;
+	if (time > maxRenderTime && SysTickVal > 100) {
+		maxRenderTime = time;
+	}
+
+	if (time > degradeThreshold) {
+		restoreCounter = 0;
+		if (level < voiceStealing) {
+			level = static_cast<Level>(level + 1);
+			++degradeEvents;
+			Apply();
+		} else if (voiceManager.StealOldestVoice()) {		// All cheaper modes in use: fade out the oldest sounding voice
+			++stolenVoices;
+		}
+
+	} else if (time < restoreThreshold && level > fullQuality) {
+		if (++restoreCounter >= restoreHoldBlocks) {
+			restoreCounter = 0;
+			level = static_cast<Level>(level - 1);
+			++restoreEvents;
+			Apply();
+		}
+
+	} else {
+		restoreCounter = 0;
+	}
+}
+
+
+void CpuGovernor::Apply()
+{
+	// Each level includes the reductions of the levels below it
+	reverb.diffuserLimit = (level >= reducedDiffusers) ? 1 : Reverb::maxDiffusers;
+	reverb.reducedMixer = (level >= reducedMixer);
+	voiceManager.samples.interpolationSuspended = (level >= noInterpolation);
+}
+
+
+const char* CpuGovernor::LevelName()
+{
+	switch (level) {
+	case fullQuality:		return "Full quality";
+	case reducedDiffusers:	return "Reduced diffusers";
+	case reducedMixer:		return "4 channel mixer";
+	case noInterpolation:	return "No sample interpolation";
+	case voiceStealing:		return "Voice stealing";
+	default:				return "";
+	}
+}
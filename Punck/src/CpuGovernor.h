@@ -0,0 +1,36 @@
+#pragma once
+
+#include "initialisation.h"
+
+// Measures the render time of each audio block against the block deadline and steps processing quality down when headroom
+// runs out so that load spikes reduce reverb density or voice count rather than causing I2S underruns. Quality is restored a
+// step at a time once load has stayed below a lower threshold for a hold period (hysteresis prevents toggling between levels)
+
+class CpuGovernor {
+public:
+	enum Level : uint8_t {fullQuality, reducedDiffusers, reducedMixer, noInterpolation, voiceStealing, levelCount};
+
+	void Update(const uint32_t time);			// Called at the end of each audio block with render time in debug timer counts
+	const char* LevelName();
+	uint32_t LoadPercent(const uint32_t time) { return time * 100 / blockDeadline; }
+
+	Level level = fullQuality;
+	uint32_t renderTime = 0;						// Debug timer counts of last rendered block
+	uint32_t maxRenderTime = 0;
+	uint32_t degradeEvents = 0;						// Number of times quality has been reduced
+	uint32_t restoreEvents = 0;						// Number of times quality has been restored
+	uint32_t stolenVoices = 0;
+
+	// Render time is measured with TIM3 which counts at 20MHz (50ns)
+	static constexpr uint32_t timerFrequency = 20000000;
+	static constexpr uint32_t blockDeadline = static_cast<uint64_t>(audioBlockSize) * timerFrequency / systemSampleRate;	// 13333 counts for 32 frames at 48kHz
+	static constexpr uint32_t degradeThreshold = blockDeadline * 85 / 100;
+	static constexpr uint32_t restoreThreshold = blockDeadline * 60 / 100;
+	static constexpr uint32_t restoreHoldBlocks = systemSampleRate / audioBlockSize;	// Load must be low for 1 second before restoring a step
+
+private:
+	void Apply();
+	uint32_t restoreCounter = 0;
+};
+
+extern CpuGovernor cpuGovernor;
@@ -0,0 +1,43 @@
+#pragma once
+#include "initialisation.h"
+
+// Lock-free single producer/single consumer ring buffer: the producer only writes writePos and the consumer only writes readPos
+// so events can be passed from an interrupt to the audio interrupt without disabling interrupts
+
+template<typename T, uint32_t size = 32>
+class EventQueue {
+	static_assert((size & (size - 1)) == 0, "Event queue size must be a power of 2");
+public:
+	uint32_t overflow = 0;					// Debug counter for events dropped when queue is full
+
+	bool Push(const T& event) {
+		const uint32_t write = writePos;
+		if (write - readPos >= size) {
+			++overflow;
+			return false;
+		}
+		buffer[write & (size - 1)] = event;
+		__DMB();							// Ensure event is stored before it is made visible to the consumer
+		writePos = write + 1;
+		return true;
+	}
+
+	T* Peek() {								// Returns pointer to oldest event or nullptr if empty
+		const uint32_t read = readPos;
+		if (read == writePos) {
+			return nullptr;
+		}
+		__DMB();
+		return &buffer[read & (size - 1)];
+	}
+
+	void Pop() {
+		__DMB();							// Ensure event has been read before slot is released to the producer
+		readPos = readPos + 1;
+	}
+
+private:
+	T buffer[size];
+	volatile uint32_t writePos = 0;
+	volatile uint32_t readPos = 0;
+};
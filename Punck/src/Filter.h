@@ -1,26 +1,51 @@
 #pragma once
 #include "initialisation.h"
 #include <cmath>
-#include <complex>
-#include <array>
 
 /*
  * Much of the filter code gratefully taken from Iowa Hills Software
  * http://www.iowahills.com/
  */
 
-typedef std::complex<float> complex_t;
-
 enum class filterPass {LowPass, HighPass, BandPass};
 
 
+// Quarter wave sine table used to calculate 2 pole filter coefficients without tan/sin/cos calls: sin and cos of half the
+// cutoff angle are looked up with linear interpolation (relative error ~5e-6) so coefficients can be updated at block rate
+struct CutoffTable {
+	static constexpr uint32_t tableSize = 256;
+
+	static float QuarterSine(const float omega)				// Returns sin(omega * pi / 2) for omega 0.0 to 1.0
+	{
+		const float pos = std::clamp(omega, 0.0f, 1.0f) * tableSize;
+		const uint32_t index = std::min(static_cast<uint32_t>(pos), tableSize - 1);
+		const float fraction = pos - index;
+		return table.value[index] + fraction * (table.value[index + 1] - table.value[index]);
+	}
+
+private:
+	struct Table {
+		float value[tableSize + 1];
+
+		Table()
+		{
+			for (uint32_t i = 0; i <= tableSize; ++i) {
+				value[i] = static_cast<float>(std::sin(0.5 * pi * i / tableSize));
+			}
+		}
+	};
+	static inline Table table;
+};
+
+
+// Transposed direct form II state of each filter section. Denormals are flushed to zero by the FPU (see InitFPU) so the only
+// protection needed is a per block check that resets the state if it has become infinite, NaN or has run away
 template<uint32_t poles = 2>
 struct IIRRegisters {
 	static constexpr uint32_t sections = (poles + 1) / 2;
-	float x1[sections];
-	float x2[sections];
-	float y1[sections];
-	float y2[sections];
+	static constexpr float maxState = 1.0e6f;
+	float z1[sections];
+	float z2[sections];
 
 	IIRRegisters() {
 		Init();
@@ -29,110 +54,75 @@ struct IIRRegisters {
 
 	void Init() {
 		for (uint8_t i = 0; i < sections; ++i) {
-			x1[i] = 0.0; x2[i] = 0.0; y1[i] = 0.0; y2[i] = 0.0;
+			z1[i] = 0.0f; z2[i] = 0.0f;
 		}
 	}
-};
 
 
-template<uint32_t poles = 2>
-class IIRPrototype {
-public:
-	IIRPrototype() {
-		DefaultProtoCoeff();
-	}
-
-	// These coeff form H(s) = 1 / (D2*s^2 + D1*s + D0)
-	struct SPlaneCoeff {
-		float D2[poles];
-		float D1[poles];
-		float D0[poles];
-	} coeff;
-
-	// Calculate the default S Plane Coefficients (Butterworth):  H(s) = 1 / (D2*s^2 + D1*s + D0)
-	void DefaultProtoCoeff()
-	{
-		std::array<complex_t, poles> roots;
-
-		// A one pole filter is simply 1/(s+1)
-		if (poles == 1) {
-			coeff.D0[0] = 1.0;
-			coeff.D1[0] = 1.0;
-			coeff.D2[0] = 0.0;
-		} else {
-			roots[0] = complex_t(0.0, 0.0);
-			ButterworthPoly(roots);
-			GetFilterCoeff(roots);
+	void Check() {
+		for (uint8_t i = 0; i < sections; ++i) {
+			if (!(std::abs(z1[i]) < maxState && std::abs(z2[i]) < maxState)) {		// Comparison is false for NaN
+				Init();
+				return;
+			}
 		}
 	}
+};
 
-private:
-	// Calculate the roots for a Butterworth filter: fill the array Roots[]
-	void ButterworthPoly(std::array<complex_t, poles> &roots)
-	{
-		uint32_t n = 0;
 
-		for (uint8_t i = 0; i < poles / 2; ++i) {
-			const float theta = pi * static_cast<float>(2 * i + poles + 1) / static_cast<float>(2 * poles);
-			roots[n++] = complex_t(cos(theta), sin(theta));
-			roots[n++] = complex_t(cos(theta), -sin(theta));
-		}
-		if (poles % 2 == 1) {
-			roots[n++] = complex_t(-1.0, 0.0);		// The real root for odd pole counts
-		}
+constexpr double ConstexprCos(const double x)				// Taylor series: accurate to double precision for 0 <= x <= pi
+{
+	double term = 1.0;
+	double sum = 1.0;
+	for (uint32_t n = 1; n < 30; ++n) {
+		term *= -x * x / static_cast<double>((2 * n - 1) * (2 * n));
+		sum += term;
 	}
+	return sum;
+}
 
 
-	// Create the 2nd order polynomials with coefficients A2, A1, A0.
-	void GetFilterCoeff(std::array<complex_t, poles> &roots)
-	{
-		// Sort the roots with the most negative real part first
-		std::sort(roots.begin(), roots.end(), [](const complex_t &lhs, const complex_t &rhs) {
-			return lhs.real() < rhs.real();
-		});
+// Butterworth prototype calculated at compile time. Coefficients form H(s) = 1 / (D2*s^2 + D1*s + D0) for each section, with
+// the most negative real part first. Butterworth roots lie on the unit circle so D0 is always one; D1 = -2 * real part of root
+template<uint32_t poles = 2>
+struct IIRPrototype {
+	static constexpr uint32_t sections = (poles + 1) / 2;
+
+	struct SPlaneCoeff {
+		float D2[sections];
+		float D1[sections];
+		float D0[sections];
+	};
 
-		// This forms the 2nd order coefficients from the root value. Ignore roots in the Right Hand Plane.
+	static constexpr SPlaneCoeff coeff = []() {
+		SPlaneCoeff c {};
 		uint32_t polyCount = 0;
-		for (uint32_t i = 0; i < poles; ++i) {
-			if (roots[i].real() > 0.0)
-				continue;							// Right Hand Plane
-			if (roots[i].real() == 0.0f && roots[i].imag() == 0.0)
-				continue;							// At the origin.  This should never happen.
-
-			if (roots[i].real() == 0.0) {			// Imag Root (A poly zero)
-				coeff.D2[polyCount] = 1.0;
-				coeff.D1[polyCount] = 0.0;
-				coeff.D0[polyCount] = roots[i].imag() * roots[i].imag();
-				++i;
-				++polyCount;
-			} else if (roots[i].imag() == 0.0) {	// Real Pole
-				coeff.D2[polyCount] = 0.0;
-				coeff.D1[polyCount] = 1.0;
-				coeff.D0[polyCount] = -roots[i].real();
-				++polyCount;
-			} else { 								// Complex Pole
-				coeff.D2[polyCount] = 1.0;
-				coeff.D1[polyCount] = -2.0f * roots[i].real();
-				coeff.D0[polyCount] = roots[i].real() * roots[i].real() + roots[i].imag() * roots[i].imag();
-				++i;
-				++polyCount;
-			}
+		if (poles % 2 == 1) {								// The real root at -1 for odd pole counts (a one pole filter is 1/(s+1))
+			c.D2[polyCount] = 0.0f;
+			c.D1[polyCount] = 1.0f;
+			c.D0[polyCount] = 1.0f;
+			++polyCount;
 		}
-	}
-
+		for (int32_t i = poles / 2 - 1; i >= 0; --i) {		// Complex conjugate pairs: higher i has more negative real part
+			const double theta = pi * static_cast<double>(2 * i + poles + 1) / static_cast<double>(2 * poles);
+			c.D2[polyCount] = 1.0f;
+			c.D1[polyCount] = static_cast<float>(-2.0 * ConstexprCos(theta));
+			c.D0[polyCount] = 1.0f;
+			++polyCount;
+		}
+		return c;
+	}();
 };
 
 
-template<uint32_t poles = 2>
+// Pass type is a template parameter so coefficient calculation only contains the code for that type of filter
+template<filterPass passType, uint32_t poles = 2>
 class IIRFilter {
 	static constexpr uint32_t sections = (poles + 1) / 2;
 public:
 	float cutoffFreq = 0.0f;
 	float bandwidthQ = 0.0f;
 
-	// constructors
-	IIRFilter(filterPass pass) : passType{pass}, iirProto(IIRPrototype()) {};
-
 	/*
 	 Calculate the z-plane coefficients for IIR filters from 2nd order S-plane coefficients
 	 H(s) = 1 / ( As^2 + Bs + C )
@@ -150,7 +140,7 @@ public:
 		cutoffFreq = omega;
 		bandwidthQ = Q;
 
-		if (passType == filterPass::BandPass) {
+		if constexpr (passType == filterPass::BandPass) {
 			// See http://shepazu.github.io/Audio-EQ-Cookbook/audio-eq-cookbook.html
 			const float w0 = pi * cutoffFreq;
 			const float n = (2.0f * Q) / (2.0f * Q + sin(w0));			// Use normalised alpha to set a0 = 1.0
@@ -169,12 +159,13 @@ public:
 
 		// Calc the IIR coefficients. SPlaneCoeff.sections is the number of 1st and 2nd order s plane factors.
 		for (uint32_t i = 0; i < sections; ++i) {
-			const float A = iirProto.coeff.D2[i];				// Always one
-			const float B = iirProto.coeff.D1[i];
-			const float C = iirProto.coeff.D0[i];				// Always one
+			constexpr auto& proto = IIRPrototype<poles>::coeff;
+			const float A = proto.D2[i];						// Always one
+			const float B = proto.D1[i];
+			const float C = proto.D0[i];						// Always one
 
 			// b's are the numerator, a's are the denominator
-			if (passType == filterPass::LowPass) {
+			if constexpr (passType == filterPass::LowPass) {
 				if (A == 0.0) {						// 1 pole case
 					const float arg = (2.0f * B + C * T);
 					iirCoeff.a2[i] = 0.0f;
@@ -196,7 +187,7 @@ public:
 				}
 			}
 
-			if (passType == filterPass::HighPass) {
+			if constexpr (passType == filterPass::HighPass) {
 				if (A == 0.0) {						// 1 pole
 					const float arg = 2.0f * C + B * T;
 					iirCoeff.a2[i] = 0.0;
@@ -221,6 +212,49 @@ public:
 	}
 
 
+	/*
+	 Calculate 2 pole low, high or band pass coefficients from the cutoff lookup table: cheap enough to call from the audio
+	 interrupt at block rate. Uses the Audio EQ Cookbook form: with Q = 1/sqrt(2) this is the same prewarped bilinear
+	 Butterworth as CalcCoeff. Cosine terms are formed from sin(w0/2) so low cutoffs keep their precision and DC/Nyquist gain
+	 is exactly unity. Filters with other pole counts fall back to CalcCoeff
+	 */
+	void SetCutoff(const float omega, const float Q = butterworthQ)	// omega = cutoff frequency / half sampling rate
+	{
+		if constexpr (poles != 2) {
+			CalcCoeff(omega, Q);
+			return;
+		}
+		if (cutoffFreq == omega && bandwidthQ == Q) {
+			return;
+		}
+		cutoffFreq = omega;
+		bandwidthQ = Q;
+
+		const float s = CutoffTable::QuarterSine(omega);		// sin(w0 / 2)
+		const float c = CutoffTable::QuarterSine(1.0f - omega);	// cos(w0 / 2)
+		const float sSquared = s * s;
+		const float alpha = s * c / Q;							// sin(w0) / 2Q
+		const float norm = 1.0f / (1.0f + alpha);				// Normalise to a0 = 1.0
+
+		iirCoeff.a1[0] = -2.0f * (1.0f - 2.0f * sSquared) * norm;
+		iirCoeff.a2[0] = (1.0f - alpha) * norm;
+
+		if constexpr (passType == filterPass::LowPass) {
+			iirCoeff.b0[0] = sSquared * norm;					// (1 - cos(w0)) / 2
+			iirCoeff.b1[0] = 2.0f * iirCoeff.b0[0];
+			iirCoeff.b2[0] = iirCoeff.b0[0];
+		} else if constexpr (passType == filterPass::HighPass) {
+			iirCoeff.b0[0] = (1.0f - sSquared) * norm;			// (1 + cos(w0)) / 2
+			iirCoeff.b1[0] = -2.0f * iirCoeff.b0[0];
+			iirCoeff.b2[0] = iirCoeff.b0[0];
+		} else {
+			iirCoeff.b0[0] = alpha * norm;						// Constant 0dB peak gain
+			iirCoeff.b1[0] = 0.0f;
+			iirCoeff.b2[0] = -iirCoeff.b0[0];
+		}
+	}
+
+
 	//	Take a new sample and return filtered value
 	float FilterSample(const float sample, IIRRegisters<poles>& registers)
 	{
@@ -231,9 +265,35 @@ public:
 		return y;
 	}
 
+
+	// Filter a block in place: the cascade is processed a section at a time so coefficients and state are held in registers
+	void FilterBlock(float* buffer, const uint32_t frames, IIRRegisters<poles>& registers)
+	{
+		for (uint32_t k = 0; k < sections; ++k) {
+			const float b0 = iirCoeff.b0[k];
+			const float b1 = iirCoeff.b1[k];
+			const float b2 = iirCoeff.b2[k];
+			const float a1 = iirCoeff.a1[k];
+			const float a2 = iirCoeff.a2[k];
+			float z1 = registers.z1[k];
+			float z2 = registers.z2[k];
+
+			for (uint32_t i = 0; i < frames; ++i) {
+				const float x = buffer[i];
+				const float y = b0 * x + z1;
+				z1 = b1 * x - a1 * y + z2;
+				z2 = b2 * x - a2 * y;
+				buffer[i] = y;
+			}
+
+			registers.z1[k] = z1;
+			registers.z2[k] = z2;
+		}
+		registers.Check();
+	}
+
 private:
-	filterPass passType = filterPass::LowPass;
-	IIRPrototype<poles> iirProto;						// Standard Butterworth is default
+	static constexpr float butterworthQ = 0.70710678f;
 
 	struct IIRCoeff {
 		float a1[sections];
@@ -246,36 +306,9 @@ private:
 	// Calculates each stage of a multi-section IIR filter (eg 8 pole is constructed from four 2-pole filters)
 	float CalcSection(const int k, const float x, IIRRegisters<poles>& registers)
 	{
-		float y, centerTap;
-		static float MaxRegVal = 1.0E-12;
-
-		// Zero the registers on an overflow condition
-		if (MaxRegVal > 1.0E6) {
-			MaxRegVal = 1.0E-12;
-			for (uint8_t i = 0; i < sections; ++i) {
-				registers.x1[i] = 0.0;
-				registers.x2[i] = 0.0;
-				registers.y1[i] = 0.0;
-				registers.y2[i] = 0.0;
-			}
-		}
-
-		centerTap = x * iirCoeff.b0[k] + iirCoeff.b1[k] * registers.x1[k] + iirCoeff.b2[k] * registers.x2[k];
-		y = centerTap - iirCoeff.a1[k] * registers.y1[k] - iirCoeff.a2[k] * registers.y2[k];
-
-		registers.x2[k] = registers.x1[k];
-		registers.x1[k] = x;
-		registers.y2[k] = registers.y1[k];
-		registers.y1[k] = y;
-
-		// MaxRegVal is used to prevent overflow. Note that CenterTap regularly exceeds 100k but y maxes out at about 65k
-		if (std::abs(centerTap) > MaxRegVal) {
-			MaxRegVal = std::abs(centerTap);
-		}
-		if (std::abs(y) > MaxRegVal) {
-			MaxRegVal = std::abs(y);
-		}
-
+		const float y = iirCoeff.b0[k] * x + registers.z1[k];
+		registers.z1[k] = iirCoeff.b1[k] * x - iirCoeff.a1[k] * y + registers.z2[k];
+		registers.z2[k] = iirCoeff.b2[k] * x - iirCoeff.a2[k] * y;
 		return y;
 	}
 
@@ -283,11 +316,11 @@ private:
 
 
 // Filter with fixed cut off (eg control smoothing)
-template<uint32_t poles = 2>
+template<filterPass passType, uint32_t poles = 2>
 class FixedFilter {
 	static constexpr uint32_t sections = (poles + 1) / 2;
 public:
-	FixedFilter(filterPass pass, float frequency) : filter{pass} {
+	FixedFilter(float frequency) {
 		filter.CalcCoeff(frequency);
 	}
 
@@ -297,18 +330,64 @@ public:
 	}
 
 private:
-	IIRFilter<poles> filter;
+	IIRFilter<passType, poles> filter;
 	IIRRegisters<poles> iirReg;
 };
 
 
 
+// Smooths a pot or CV reading and maps it to a cutoff: shared by the biquad and state variable filters
+template<filterPass passType>
+class FilterControl {
+public:
+	FilterControl(volatile uint16_t* adc) : adcControl{adc} {}
+
+	bool Update(const bool reset, float& cutoff)	// Returns true with the new cutoff if the control has moved
+	{
+		// get filter values from pot and CV and smooth through fixed IIR filter
+		if (adcControl == nullptr) {
+			return false;
+		}
+
+		dampedADC = filterADC.FilterSample(*adcControl);
+		if (reset || std::abs(dampedADC - previousADC) > hysteresis) {
+			previousADC = dampedADC;
+			cutoff = Cutoff(dampedADC);
+			return true;
+		}
+		return false;
+	}
+
+private:
+	volatile uint16_t* adcControl;
+	float dampedADC, previousADC;			// ADC readings governing damped cut off level (and previous for hysteresis)
+	FixedFilter<filterPass::LowPass> filterADC {0.002f};
+	static constexpr uint16_t hysteresis = 30;
+
+	static float Cutoff(const float tone)	// tone is a 0-65535 number representing cutoff generally from ADC input
+	{
+		float cutoff;
+		constexpr float LPMax = 0.995;
+		constexpr float HPMin = 0.001;
+
+		if constexpr (passType == filterPass::HighPass || passType == filterPass::BandPass) {		// Want a sweep from 0.03 to 0.99 with most travel at low end
+			const float t = tone / 100000.0f;
+			cutoff = t * t * t + HPMin;
+		} else {																		// Want a sweep from 0.001 to 0.2-0.3
+			const float t = tone / 65536.0f;
+			cutoff = std::min(0.03f + t * t, LPMax);
+		}
+		return cutoff / sampleRateScale;		// Sweep is relative to the Nyquist frequency at 48kHz
+	}
+};
+
+
 // 2 channel LP or HP filter with dual sets of coefficients to allow clean recalculation and switching
-template<uint32_t poles = 2>
+template<filterPass passType, uint32_t poles = 2>
 struct Filter {
 	static constexpr uint32_t sections = (poles + 1) / 2;
 public:
-	Filter(filterPass pass, volatile uint16_t* adc) : passType{pass}, iirFilter{IIRFilter<poles>(pass), IIRFilter<poles>(pass)}, adcControl{adc}
+	Filter(volatile uint16_t* adc) : control{adc}
 	{
 		Update(true);								// Force calculation of coefficients
 	}
@@ -326,7 +405,7 @@ public:
 		// cutoff passed as omega - ie cutoff_frequency / nyquist
 		if (iirFilter[activeFilter].cutoffFreq != cutoff) {
 			const bool inactiveFilter = !activeFilter;
-			iirFilter[inactiveFilter].CalcCoeff(cutoff);
+			iirFilter[inactiveFilter].SetCutoff(cutoff);
 			activeFilter = inactiveFilter;			// Switch active filter
 			currentCutoff = cutoff;					// Debug
 		}
@@ -335,57 +414,36 @@ public:
 
 	void Update(bool reset)
 	{
-		// get filter values from pot and CV and smooth through fixed IIR filter
-		if (adcControl == nullptr) {
-			return;
+		float cutoff;
+		if (control.Update(reset, cutoff)) {
+			const bool inactiveFilter = !activeFilter;
+			iirFilter[inactiveFilter].SetCutoff(cutoff);
+			activeFilter = inactiveFilter;			// Switch active filter
+			currentCutoff = cutoff;					// Debug
 		}
+	}
 
-		dampedADC = filterADC.FilterSample(*adcControl);
-		if (reset || std::abs(dampedADC - previousADC) > hysteresis) {
-			previousADC = dampedADC;
-			InitIIRFilter(dampedADC);
-			activeFilter = !activeFilter;			// Switch active filter
-		}
+
+	void Process(float* bufferL, float* bufferR, const uint32_t frames)		// Filter a stereo block in place
+	{
+		iirFilter[activeFilter].FilterBlock(bufferL, frames, iirReg[left]);
+		iirFilter[activeFilter].FilterBlock(bufferR, frames, iirReg[right]);
 	}
 
 
-	float CalcFilter(const float sample, const channel c)
+	void Process(float* buffer, const uint32_t frames, const channel c)		// Filter a single channel block in place
 	{
-		return iirFilter[activeFilter].FilterSample(sample, iirReg[c]);		//	Take a new sample and return filtered value
+		iirFilter[activeFilter].FilterBlock(buffer, frames, iirReg[c]);
 	}
 
 private:
-	float potCentre = 29000;				// Configurable in calibration
-
-	const filterPass passType;
 	bool activeFilter = 0;					// choose which set of coefficients to use (so coefficients can be calculated without interfering with current filtering)
 	float currentCutoff;
 
-	IIRFilter<poles> iirFilter[2];			// Two filters for active and inactive
+	IIRFilter<passType, poles> iirFilter[2];	// Two filters for active and inactive
 	IIRRegisters<poles> iirReg[2];			// Two channels (left and right)
 
-	volatile uint16_t* adcControl;
-	float dampedADC, previousADC;			// ADC readings governing damped cut off level (and previous for hysteresis)
-	FixedFilter<poles> filterADC = FixedFilter(filterPass::LowPass, 0.002f);
-	static constexpr uint16_t hysteresis = 30;
-
-	void InitIIRFilter(const float tone)	// tone is a 0-65535 number representing cutoff generally from ADC input
-	{
-		float cutoff;
-		constexpr float LPMax = 0.995;
-		constexpr float HPMin = 0.001;
-
-		const bool inactiveFilter = !activeFilter;
-
-		if (passType == filterPass::HighPass || passType == filterPass::BandPass) {		// Want a sweep from 0.03 to 0.99 with most travel at low end
-			cutoff = pow((tone / 100000.0), 3.0) + HPMin;
-		} else {																		// Want a sweep from 0.001 to 0.2-0.3
-			cutoff = std::min(0.03f + std::pow(tone / 65536.0f, 2.0f), LPMax);
-		}
-		iirFilter[inactiveFilter].CalcCoeff(cutoff);
-
-		currentCutoff = cutoff;						// Debug
-	}
+	FilterControl<passType> control;
 };
 
 
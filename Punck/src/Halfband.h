@@ -0,0 +1,90 @@
+#pragma once
+#include "initialisation.h"
+#include "Filter.h"
+
+// Polyphase halfband FIR filters for sample rate conversion by 2. Apart from the centre tap of 0.5 every other tap of a
+// halfband filter is zero, so each output needs one multiply per symmetric pair of non-zero taps. Coefficients are a Blackman
+// windowed sinc calculated at compile time: filter length is 4 * pairs - 1 with the cutoff at a quarter of the higher rate
+
+template<uint32_t pairs>
+struct HalfbandPrototype {
+	static constexpr uint32_t centre = 2 * pairs - 1;		// Offset of centre tap (group delay in high rate samples)
+
+	struct Coeff {
+		float g[pairs];										// Taps at centre +/- (2j + 1)
+	};
+
+	static constexpr Coeff coeff = []() {
+		double g[pairs] {};
+		double sum = 0.0;
+		for (uint32_t j = 0; j < pairs; ++j) {
+			// Sinc at odd offsets d from the centre is +/-1 / (pi * d); Blackman window cos(2x) terms use 2cos^2(x) - 1
+			const double d = 2 * j + 1;
+			const double c = ConstexprCos(pi * d / (centre + 1));
+			const double window = 0.42 + 0.5 * c + 0.08 * (2.0 * c * c - 1.0);
+			g[j] = ((j & 1) ? -1.0 : 1.0) / (pi * d) * window;
+			sum += g[j];
+		}
+
+		Coeff c {};
+		for (uint32_t j = 0; j < pairs; ++j) {
+			c.g[j] = static_cast<float>(0.25 * g[j] / sum);		// Normalise to unity gain at DC (centre tap + both sides = 1)
+		}
+		return c;
+	}();
+};
+
+
+template<uint32_t pairs = 6>
+class HalfbandDecimator {
+public:
+	void Process(const float* in, float* out, const uint32_t frames)		// Writes frames / 2 samples: out may be the same as in
+	{
+		std::copy(in, &in[frames], &buffer[history]);
+
+		const auto& g = HalfbandPrototype<pairs>::coeff.g;
+		for (uint32_t m = 0; m < frames / 2; ++m) {
+			const float* x = &buffer[centre + 2 * m];
+			float sum = 0.5f * x[0];
+			for (uint32_t j = 0; j < pairs; ++j) {
+				sum += g[j] * (x[2 * j + 1] + x[-static_cast<int32_t>(2 * j + 1)]);
+			}
+			out[m] = sum;
+		}
+
+		std::copy(&buffer[frames], &buffer[frames + history], buffer);		// Keep oldest samples needed by next block
+	}
+
+private:
+	static constexpr uint32_t centre = HalfbandPrototype<pairs>::centre;
+	static constexpr uint32_t history = 2 * centre;
+	float buffer[history + audioBlockSize] = {};
+};
+
+
+template<uint32_t pairs = 6>
+class HalfbandInterpolator {
+public:
+	void Process(const float* in, float* out, const uint32_t frames)		// Writes frames * 2 samples: out may be the same as in
+	{
+		std::copy(in, &in[frames], &buffer[history]);
+
+		// Zero stuffed input filtered with double gain: odd outputs fall on the centre tap, even outputs on the non-zero pairs
+		const auto& g = HalfbandPrototype<pairs>::coeff.g;
+		for (uint32_t m = 0; m < frames; ++m) {
+			const float* x = &buffer[pairs + m];
+			float sum = 0.0f;
+			for (uint32_t j = 0; j < pairs; ++j) {
+				sum += g[j] * (x[j] + x[-static_cast<int32_t>(j + 1)]);
+			}
+			out[2 * m] = 2.0f * sum;
+			out[2 * m + 1] = x[0];
+		}
+
+		std::copy(&buffer[frames], &buffer[frames + history], buffer);
+	}
+
+private:
+	static constexpr uint32_t history = 2 * pairs - 1;
+	float buffer[history + audioBlockSize] = {};
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "initialisation.h"
+
+// Region allocator over a fixed pool in one of the large SRAM regions (see main.cpp). Long lived buffers are allocated from the
+// bottom of the pool; the reverb allocates its delay lines from the top and releases them together whenever its configuration
+// changes. Space the reverb does not need at its current size is therefore available to bottom allocations (and vice versa).
+// Allocations are pointer bumps with no individual free so there is no fragmentation. Arenas are only changed from the idle
+// loop: there is no locking
+
+class MemoryArena {
+public:
+	constexpr MemoryArena(uint8_t* pool, const uint32_t size) : pool{pool}, size{size}, low{0}, high{size} {}
+
+	template<typename T>
+	T* Allocate(const uint32_t count)			// Long lived allocation from the bottom of the pool: nullptr if there is no space
+	{
+		const uint32_t start = (low + alignof(T) - 1) & ~(alignof(T) - 1);
+		if (start > high || count > (high - start) / sizeof(T)) {
+			return nullptr;
+		}
+		low = start + count * sizeof(T);
+		return reinterpret_cast<T*>(&pool[start]);
+	}
+
+
+	template<typename T>
+	T* AllocateTop(const uint32_t count)		// Reconfigurable allocation from the top of the pool: nullptr if there is no space
+	{
+		if (count > (high - low) / sizeof(T)) {
+			return nullptr;
+		}
+		const uint32_t start = (high - count * sizeof(T)) & ~(alignof(T) - 1);
+		if (start < low) {
+			return nullptr;
+		}
+		high = start;
+		return reinterpret_cast<T*>(&pool[start]);
+	}
+
+
+	template<typename T>
+	uint32_t Fits()								// Number of T that a bottom allocation could currently hold
+	{
+		const uint32_t start = (low + alignof(T) - 1) & ~(alignof(T) - 1);
+		return (start < high) ? (high - start) / sizeof(T) : 0;
+	}
+
+
+	void ReleaseTop()							// Release all allocations made from the top of the pool
+	{
+		high = size;
+	}
+
+
+	void ReleaseBottom()						// Release all allocations made from the bottom of the pool
+	{
+		low = 0;
+	}
+
+
+	uint32_t Size()			{ return size; }
+	uint32_t TopUsed()		{ return size - high; }
+	uint32_t BottomUsed()	{ return low; }
+	uint32_t Available()	{ return high - low; }
+
+private:
+	uint8_t* const pool;
+	const uint32_t size;
+	uint32_t low;								// Bottom allocations end
+	uint32_t high;								// Top allocations start
+};
+
+extern MemoryArena ramD1Arena;
+extern MemoryArena ramD2Arena;
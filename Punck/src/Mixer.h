@@ -0,0 +1,117 @@
+#pragma once
+
+#include "initialisation.h"
+#include <cstring>
+#include <cmath>
+
+// Per-voice mixer: each voice channel has a level, constant power pan and post fader reverb send. Voices are mixed a block at a
+// time into the main mix and a separate reverb send bus so dry voices (eg kick) do not feed the reverb
+
+class Mixer {
+public:
+	static constexpr uint32_t channels = 8;					// One channel per VoiceManager::Voice (sampler A and B are mixed separately)
+
+	Mixer()
+	{
+		StoreConfig(nullptr);
+	}
+
+
+	void Mix(const uint32_t channel, const float* inL, const float* inR, float* mixL, float* mixR, float* sendL, float* sendR, bool& mixEmpty, bool& sendEmpty)
+	{
+		// Mix a block of voice output into the main mix and, if the voice has a send level, the reverb send bus
+		const Gains& g = gains[activeGains][channel];
+		if (mixEmpty) {
+			MixBlock<false>(inL, mixL, g.left);
+			MixBlock<false>(inR, mixR, g.right);
+			mixEmpty = false;
+		} else {
+			MixBlock<true>(inL, mixL, g.left);
+			MixBlock<true>(inR, mixR, g.right);
+		}
+
+		if (g.sendLeft > 0.0f || g.sendRight > 0.0f) {
+			if (sendEmpty) {
+				MixBlock<false>(inL, sendL, g.sendLeft);
+				MixBlock<false>(inR, sendR, g.sendRight);
+				sendEmpty = false;
+			} else {
+				MixBlock<true>(inL, sendL, g.sendLeft);
+				MixBlock<true>(inR, sendR, g.sendRight);
+			}
+		}
+	}
+
+
+	uint32_t SerialiseConfig(uint8_t** buff)
+	{
+		*buff = reinterpret_cast<uint8_t*>(&config);
+		return sizeof(config);
+	}
+
+
+	uint32_t StoreConfig(uint8_t* buff)
+	{
+		if (buff != nullptr) {
+			memcpy(&config, buff, sizeof(config));
+		}
+
+		// Verify settings and calculate channel gains: pan law is normalised so a centred channel has unity gain. Non-finite values
+		// (which clamp would pass through) are replaced with the defaults
+		const Channel defaults;
+		auto verify = [](float& value, const float low, const float high, const float fallback) {
+			value = std::isfinite(value) ? std::clamp(value, low, high) : fallback;
+		};
+
+		// Gains are calculated into the set not in use by the audio interrupt, which is then switched to
+		const uint32_t update = activeGains ^ 1;
+		for (uint32_t c = 0; c < channels; ++c) {
+			Channel& ch = config.channel[c];
+			verify(ch.level, 0.0f, 2.0f, defaults.level);
+			verify(ch.pan, 0.0f, 1.0f, defaults.pan);
+			verify(ch.send, 0.0f, 1.0f, defaults.send);
+
+			Gains& g = gains[update][c];
+			const float angle = ch.pan * static_cast<float>(pi) * 0.5f;
+			g.left = ch.level * std::sqrt(2.0f) * std::cos(angle);
+			g.right = ch.level * std::sqrt(2.0f) * std::sin(angle);
+			g.sendLeft = g.left * ch.send;
+			g.sendRight = g.right * ch.send;
+		}
+		__DMB();											// Ensure gains are stored before they are made visible to the audio interrupt
+		activeGains = update;
+
+		return sizeof(config);
+	}
+
+private:
+	template <bool accumulate>
+	static void MixBlock(const float* in, float* out, const float gain)
+	{
+		for (uint32_t i = 0; i < audioBlockSize; ++i) {
+			if constexpr (accumulate) {
+				out[i] += gain * in[i];
+			} else {
+				out[i] = gain * in[i];
+			}
+		}
+	}
+
+	struct Gains {
+		float left;
+		float right;
+		float sendLeft;
+		float sendRight;
+	} gains[2][channels];									// Double buffered: StoreConfig runs in the USB interrupt
+	volatile uint32_t activeGains = 0;						// Set of gains read by Mix
+
+	struct Channel {
+		float level = 1.0f;
+		float pan = 0.5f;									// 0 = left; 0.5 = centre; 1 = right
+		float send = 1.0f;									// Reverb send (post level and pan)
+	};
+
+	struct Config {
+		Channel channel[channels];
+	} config;
+};
@@ -0,0 +1,181 @@
+#pragma once
+#include "initialisation.h"
+#include "Filter.h"
+
+// Topology preserving transform (trapezoidal integrator) state variable filter, after Zavalishin and Simper. Low, band and
+// high pass outputs are produced together from the same two integrator states; the frequency response is the same prewarped
+// bilinear design as IIRFilter::SetCutoff. Unlike a biquad the state stays valid when the coefficients change, so cutoff
+// changes are ramped per sample across the next block rather than switched between two coefficient sets.
+// Has the same interface as Filter so it can be swapped in for pot controlled and swept voice filters
+
+template<filterPass passType>
+class SVFilter {
+public:
+	static constexpr float butterworthQ = 0.70710678f;
+	float cutoffFreq = 0.0f;				// Target cutoff as omega
+
+	struct State {
+		float ic1 = 0.0f;					// Integrator states
+		float ic2 = 0.0f;
+	};
+
+	struct Outputs {
+		float lowPass;
+		float bandPass;						// Normalised to 0dB peak gain (as IIRFilter band pass)
+		float highPass;
+	};
+
+	SVFilter(volatile uint16_t* adc) : control{adc}
+	{
+		SetCutoff(0.5f);
+		Init();
+		Update(true);
+	}
+
+
+	void Init()								// Clear state and jump to the target cutoff (eg at the start of a note)
+	{
+		for (auto& s : state) {
+			s.ic1 = 0.0f; s.ic2 = 0.0f;
+		}
+		g = targetG;
+		CalcCoeff(g);
+	}
+
+
+	void SetCutoff(const float omega, const float Q = butterworthQ)	// omega = cutoff frequency / half sampling rate
+	{
+		// g = tan(w0 / 2) from the cutoff table; the change is ramped across the next processed block
+		cutoffFreq = omega;
+		const float w = std::clamp(omega, 0.0f, maxOmega);
+		targetG = CutoffTable::QuarterSine(w) / CutoffTable::QuarterSine(1.0f - w);
+		if (Q != 1.0f / k) {
+			k = 1.0f / Q;
+			CalcCoeff(g);
+		}
+	}
+
+
+	void Update(bool reset)
+	{
+		float cutoff;
+		if (control.Update(reset, cutoff)) {
+			SetCutoff(cutoff);
+		}
+	}
+
+
+	State GetState(const channel c)						{ return state[c]; }
+	void SetState(const channel c, const State& s)		{ state[c] = s; }
+
+
+	Outputs Tick(const float x, const channel c)			// Filter a single sample at the current cutoff returning all outputs
+	{
+		State& s = state[c];
+		const float v3 = x - s.ic2;
+		const float v1 = a1 * s.ic1 + a2 * v3;
+		const float v2 = s.ic2 + a2 * s.ic1 + a3 * v3;
+		s.ic1 = 2.0f * v1 - s.ic1;
+		s.ic2 = 2.0f * v2 - s.ic2;
+		return {v2, k * v1, x - k * v1 - v2};
+	}
+
+
+	void Process(float* bufferL, float* bufferR, const uint32_t frames)		// Filter a stereo block in place
+	{
+		ProcessBlock<2>({bufferL, bufferR}, {&state[left], &state[right]}, frames);
+	}
+
+
+	void Process(float* buffer, const uint32_t frames, const channel c)		// Filter a single channel block in place
+	{
+		ProcessBlock<1>({buffer}, {&state[c]}, frames);
+	}
+
+private:
+	static constexpr float maxOmega = 0.995f;
+	static constexpr float maxState = 1.0e6f;
+
+	State state[2];							// Two channels (left and right)
+
+	float g = 0.0f;							// Current and target integrator gain tan(w0 / 2)
+	volatile float targetG = 0.0f;			// Written by SetCutoff from the idle loop while the audio interrupt ramps towards it
+	float k = 1.0f / butterworthQ;			// Damping (1 / Q)
+	float a1, a2, a3;
+
+	FilterControl<passType> control;
+
+	void CalcCoeff(const float gain)
+	{
+		a1 = 1.0f / (1.0f + gain * (gain + k));
+		a2 = gain * a1;
+		a3 = gain * a2;
+	}
+
+
+	static float Output(const float x, const float v1, const float v2, const float k)
+	{
+		if constexpr (passType == filterPass::LowPass) {
+			return v2;
+		} else if constexpr (passType == filterPass::HighPass) {
+			return x - k * v1 - v2;
+		} else {
+			return k * v1;
+		}
+	}
+
+
+	template<uint32_t channels>
+	void ProcessBlock(float* const (&buffer)[channels], State* const (&st)[channels], const uint32_t frames)
+	{
+		// Channels are processed together so a cutoff ramp costs one coefficient calculation per sample for both channels
+		float ic1[channels], ic2[channels];
+		for (uint32_t c = 0; c < channels; ++c) {
+			ic1[c] = st[c]->ic1;
+			ic2[c] = st[c]->ic2;
+		}
+		const float damping = k;
+		const float target = targetG;		// Read once: ramp step and final gain must use the same target
+
+		if (g == target || frames == 0) {
+			const float c1 = a1, c2 = a2, c3 = a3;
+			for (uint32_t i = 0; i < frames; ++i) {
+				for (uint32_t c = 0; c < channels; ++c) {
+					const float x = buffer[c][i];
+					const float v3 = x - ic2[c];
+					const float v1 = c1 * ic1[c] + c2 * v3;
+					const float v2 = ic2[c] + c2 * ic1[c] + c3 * v3;
+					ic1[c] = 2.0f * v1 - ic1[c];
+					ic2[c] = 2.0f * v2 - ic2[c];
+					buffer[c][i] = Output(x, v1, v2, damping);
+				}
+			}
+		} else {
+			float gain = g;
+			const float gainInc = (target - g) / frames;
+			for (uint32_t i = 0; i < frames; ++i) {
+				gain += gainInc;
+				const float c1 = 1.0f / (1.0f + gain * (gain + damping));
+				const float c2 = gain * c1;
+				const float c3 = gain * c2;
+				for (uint32_t c = 0; c < channels; ++c) {
+					const float x = buffer[c][i];
+					const float v3 = x - ic2[c];
+					const float v1 = c1 * ic1[c] + c2 * v3;
+					const float v2 = ic2[c] + c2 * ic1[c] + c3 * v3;
+					ic1[c] = 2.0f * v1 - ic1[c];
+					ic2[c] = 2.0f * v2 - ic2[c];
+					buffer[c][i] = Output(x, v1, v2, damping);
+				}
+			}
+			g = target;
+			CalcCoeff(g);
+		}
+
+		for (uint32_t c = 0; c < channels; ++c) {
+			const bool valid = std::abs(ic1[c]) < maxState && std::abs(ic2[c]) < maxState;	// Comparison is false for NaN
+			st[c]->ic1 = valid ? ic1[c] : 0.0f;
+			st[c]->ic2 = valid ? ic2[c] : 0.0f;
+		}
+	}
+};
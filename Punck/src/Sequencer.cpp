@@ -142,8 +142,9 @@ void Sequencer::StartStop(uint8_t seq)
 }
 
 
-void Sequencer::Play()
+void Sequencer::Play(const uint32_t frames)
 {
+	// Called at control rate: advances sequence by a block of frames
 	if (playing) {
 		Sequence& seq = sequence[activeSequence];
 
@@ -151,21 +152,29 @@ void Sequencer::Play()
 			currentBar = 0;
 		}
 
-		// Get tempo
-		tempo = 0.9f * tempo + 0.1f * (0.25f * ADC_array[ADC_Tempo]);
-		uint32_t beatLen = (18000.0f - tempo) * (16.0f / (float)seq.info.beatsPerBar);
+		// Get tempo (pot is smoothed at control rate)
+		tempo = 0.25f * controlADC[ADC_Tempo];
+		const uint32_t beatLen = BeatLength(seq.info.beatsPerBar);
 
-		if (position == 0) {
-			if (clockEveryTick || (currentBeat % (seq.info.beatsPerBar == 16 ? 4 : 6) == 0)) {
-				GPIOD->ODR |= GPIO_ODR_OD9;					// PD9: activate tempo out
-				clockOn = SysTickVal;
+		// Position counts samples from start of current beat; beats starting within this block are queued at their frame offset
+		uint32_t remaining = frames;
+		while (remaining > 0) {
+			if (position == 0) {
+				PlayBeat(seq, frames - remaining);
 			}
 
-			for (uint32_t i = 0; i < VoiceManager::Voice::count; ++i) {
-				auto& b = seq.bar[currentBar].beat[currentBeat][i];
-				if (b.level > 0) {
-					auto& note = voiceManager.noteMapper[i];
-					note.drumVoice->Play(note.voiceIndex, b.index, 0, static_cast<float>(b.level) / 127.0f);
+			const uint32_t beatRemaining = beatLen + 1 - std::min(position, beatLen);
+			if (beatRemaining > remaining) {
+				position += remaining;
+				break;
+			}
+
+			remaining -= beatRemaining;
+			position = 0;
+			if (++currentBeat >= seq.info.beatsPerBar) {
+				currentBeat = 0;
+				if (++currentBar >= seq.info.bars) {
+					currentBar = 0;
 				}
 			}
 		}
@@ -175,19 +184,33 @@ void Sequencer::Play()
 			clockOn = 0;
 			GPIOD->ODR &= ~GPIO_ODR_OD9;				// PD9: clear tempo out pin
 		}
+	}
+}
 
-		if (++position > beatLen) {
-			position = 0;
-			if (++currentBeat >= seq.info.beatsPerBar) {
-				currentBeat = 0;
-				++currentBar;
-			}
-		}
 
+void Sequencer::PlayBeat(Sequence& seq, const uint32_t frameOffset)
+{
+	if (clockEveryTick || (currentBeat % (seq.info.beatsPerBar == 16 ? 4 : 6) == 0)) {
+		GPIOD->ODR |= GPIO_ODR_OD9;						// PD9: activate tempo out
+		clockOn = SysTickVal;
+	}
+
+	for (uint32_t i = 0; i < VoiceManager::Voice::count; ++i) {
+		auto& b = seq.bar[currentBar].beat[currentBeat][i];
+		if (b.level > 0) {
+			voiceManager.QueueNote(VoiceManager::sequencerSource, frameOffset, i, b.index, 0, static_cast<float>(b.level) / 127.0f);
+		}
 	}
 }
 
 
+float Sequencer::BeatLength(const uint8_t beatsPerBar)
+{
+	// Beat length in samples: tempo ranges are defined in samples at 48kHz
+	return (18000.0f - tempo) * (16.0f / (float)beatsPerBar) * sampleRateScale;
+}
+
+
 void Sequencer::ChangeSequence(uint8_t seq)
 {
 	// Change playing sequence to synchronise time when changing between different beats per bar
@@ -198,9 +221,9 @@ void Sequencer::ChangeSequence(uint8_t seq)
 		if (playing && oldSeq.beatsPerBar != newSeq.beatsPerBar) {
 
 			// Normalise position
-			float oldbeatLen = (18000.0f - tempo) * (16.0f / (float)oldSeq.beatsPerBar);
+			float oldbeatLen = BeatLength(oldSeq.beatsPerBar);
 			float oldPos = (float)position + (oldbeatLen * currentBeat);
-			float newbeatLen = (18000.0f - tempo) * (16.0f / (float)newSeq.beatsPerBar);
+			float newbeatLen = BeatLength(newSeq.beatsPerBar);
 
 			currentBeat = std::floor(oldPos / newbeatLen);
 			position = oldPos - (currentBeat * newbeatLen);
@@ -20,7 +20,7 @@ public:
 
 	Sequencer();
 	void StartStop(uint8_t sequence);
-	void Play();
+	void Play(const uint32_t frames);
 	SeqInfo GetSeqInfo(uint8_t seq);
 
 	uint32_t GetBar(uint8_t** buff, uint8_t seq, uint8_t bar);
@@ -47,6 +47,8 @@ private:
 	static const uint32_t currSeqBrightness = 200;	// brightness of led indicating playing sequence
 	uint32_t clockOn;				// Time when tempo clock is turned on to schedule switching off
 	void ChangeSequence(uint8_t newSeq);
+	float BeatLength(const uint8_t beatsPerBar);
+	void PlayBeat(Sequence& seq, const uint32_t frameOffset);
 };
 
 extern Sequencer sequencer;
@@ -78,6 +78,11 @@ uint32_t Config::SetConfig()
 	memcpy(&configBuffer[configPos], cfgBuffer, configSize);
 	configPos += configSize;
 
+	// Mixer settings
+	configSize = voiceManager.mixer.SerialiseConfig(&cfgBuffer);
+	memcpy(&configBuffer[configPos], cfgBuffer, configSize);
+	configPos += configSize;
+
 	// MIDI note map
 	configSize = voiceManager.GetConfig(&cfgBuffer);
 	memcpy(&configBuffer[configPos], cfgBuffer, configSize);
@@ -116,6 +121,9 @@ void Config::RestoreConfig()
 		// Reverb Settings
 		configPos += reverb.StoreConfig(&flashConfig[configPos]);
 
+		// Mixer Settings
+		configPos += voiceManager.mixer.StoreConfig(&flashConfig[configPos]);
+
 		// MIDI note map
 		configPos += voiceManager.StoreConfig(&flashConfig[configPos]);
 
@@ -133,6 +141,8 @@ void Config::RestoreConfig()
 		// Reverb Settings
 		reverb.StoreConfig(nullptr);
 
+		// Mixer Settings
+		voiceManager.mixer.StoreConfig(nullptr);
 	}
 }
 
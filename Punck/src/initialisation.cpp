@@ -7,7 +7,7 @@
 // Clock overview:
 // [Main clock (Nucleo): 8MHz (HSE) / 2 (M) * 200 (N) / 2 (P) = 400MHz]
 // Main clock (v1): 12MHz (HSE) / 3 (M) * 200 (N) / 2 (P) = 400MHz
-// I2S: Peripheral Clock (AKA per_ck) set to HSI = 64MHz
+// I2S: PLL3 P output: 12MHz (HSE) / 5 (M) * 128 (N) / 10 (P) = 30.72MHz
 // ADC: Peripheral Clock (AKA per_ck) set to HSI = 64MHz
 
 #if CPUCLOCK == 400
@@ -28,6 +28,12 @@
 #define PLL_R1 2
 #endif
 
+// I2S clock: 12MHz (HSE) / 5 (M) * 128 (N) / 10 (P) = 30.72MHz - divides exactly to 48kHz and 96kHz
+#define PLL_M3 5
+#define PLL_N3 128
+#define PLL_P3 10
+static constexpr uint32_t i2sKernelClock = 12000000 / PLL_M3 * PLL_N3 / PLL_P3;
+
 
 void InitClocks()
 {
@@ -86,6 +92,7 @@ void InitClocks()
 
 void InitHardware()
 {
+	InitFPU();						// Flush denormals to zero
 	InitSysTick();
 	InitPWMTimer();					// PWM Timers used for adjustable LED brightness
 	InitDebugTimer();				// Timer 3 used for performance testing
@@ -99,6 +106,15 @@ void InitHardware()
 }
 
 
+void InitFPU()
+{
+	// Flush denormal floats to zero so decaying filter and reverb state does not fall into slow denormal arithmetic.
+	// Exception handlers load FPSCR from FPDSCR so the audio interrupts need the setting there as well as in thread mode
+	FPU->FPDSCR |= FPU_FPDSCR_FZ_Msk;
+	__set_FPSCR(__get_FPSCR() | FPU_FPDSCR_FZ_Msk);
+}
+
+
 void InitMDMA()
 {
 	// Initialises MDMA to background transfers of data from QSPI Flash to RAM
@@ -144,14 +160,14 @@ void InitCache()
 {
 	// Use the Memory Protection Unit (MPU) to set up a region of memory with data caching disabled for use with DMA buffers
 	MPU->RNR = 0;									// Memory region number
-	MPU->RBAR = reinterpret_cast<uint32_t>(&ADC_array);	// Store the address of the ADC_array into the region base address register
+	MPU->RBAR = D3_SRAM_BASE;						// RAM_D3 holds the .dma_buffer section (ADC_array and audioBuffer)
 
 	MPU->RASR = (0b11  << MPU_RASR_AP_Pos)   |		// All access permitted
 				(0b001 << MPU_RASR_TEX_Pos)  |		// Type Extension field: See truth table on p228 of Cortex M7 programming manual
 				(1     << MPU_RASR_S_Pos)    |		// Shareable: provides data synchronization between bus masters. Eg a processor with a DMA controller
 				(0     << MPU_RASR_C_Pos)    |		// Cacheable
 				(0     << MPU_RASR_B_Pos)    |		// Bufferable (ignored for non-cacheable configuration)
-				(5     << MPU_RASR_SIZE_Pos) |		// Size is log 2(mem size) - 1 ie 2^6 = 64
+				(15    << MPU_RASR_SIZE_Pos) |		// Size is log 2(mem size) - 1 ie 2^16 = 64K (all of RAM_D3)
 				(1     << MPU_RASR_ENABLE_Pos);		// Enable MPU region
 
 
@@ -416,7 +432,7 @@ void InitI2S()
 	SPI2->I2SCFGR |= SPI_I2SCFGR_CHLEN;				// Channel Length = 32 bits
 
 	SPI2->CFG1 |= SPI_CFG1_UDRCFG_1;				// In the event of underrun resend last transmitted data frame
-	SPI2->CFG1 |= SPI_CFG1_FTHLV_1;					// FIFO threshold level. 0001: 2-data
+	SPI2->CFG1 &= ~SPI_CFG1_FTHLV;					// FIFO threshold level. 0000: 1-data (DMA request per word)
 
 	/* I2S Clock
 	000: pll1_q_ck clock selected as SPI/I2S1,2 and 3 kernel clock (default after reset)
@@ -434,10 +450,33 @@ void InitI2S()
 	I2S Clock = 300MHz:			280000000 / (32*2  * ((2 * 45) + 1)) = 48076.92
 	I2S Clock = 320MHz: 		320000000 / (32*2  * ((2 * 52) + 0)) = 48076.92
 	PER_CLK = 64MHz				64000000  / (32*2  * ((2 * 10) + 1)) = 47619.05
+	PLL3P = 30.72MHz			30720000  / (32*2  * ((2 * 5) + 0))  = 48000
+								30720000  / (32*2  * ((2 * 2) + 1))  = 96000
 
 	Note timing problems experienced using both pll1_q_ck and pll2_p_ck when FMC controller is using PLL2
 	*/
-#define I2S_PER_CLK
+#define I2S_PLL3P_CLK
+#ifdef I2S_PLL3P_CLK
+	// Use dedicated PLL3 so the sample rate is exact: prescaler is derived from the system sample rate
+	static constexpr uint32_t i2sPrescaler = i2sKernelClock / (64 * systemSampleRate);		// (2 * I2SDIV) + ODD
+	static_assert(i2sKernelClock % (64 * systemSampleRate) == 0, "I2S clock does not divide exactly to sample rate");
+
+	RCC->PLLCKSELR = (RCC->PLLCKSELR & ~RCC_PLLCKSELR_DIVM3) | PLL_M3 << RCC_PLLCKSELR_DIVM3_Pos;
+	RCC->PLLCFGR |= RCC_PLLCFGR_PLL3RGE_1;			// 01: The PLL3 input (ref3_ck) clock range frequency is between 2 and 4 MHz (12MHz / 5 = 2.4MHz)
+	RCC->PLLCFGR &= ~RCC_PLLCFGR_PLL3VCOSEL;		// 0: Wide VCO range:192 to 836 MHz (VCO = 307.2MHz)
+	RCC->PLLCFGR &= ~(RCC_PLLCFGR_DIVQ3EN | RCC_PLLCFGR_DIVR3EN);
+	RCC->PLLCFGR |= RCC_PLLCFGR_DIVP3EN;			// Only P output used
+	RCC->PLL3DIVR = (PLL_N3 - 1) << RCC_PLL3DIVR_N3_Pos |
+			        (PLL_P3 - 1) << RCC_PLL3DIVR_P3_Pos;
+	RCC->CR |= RCC_CR_PLL3ON;
+	while ((RCC->CR & RCC_CR_PLL3RDY) == 0);		// Wait till PLL is ready
+
+	RCC->D2CCIP1R |= RCC_D2CCIP1R_SPI123SEL_1;		// 010: pll3_p_ck clock selected as SPI/I2S1,2 and 3 kernel clock
+	SPI2->I2SCFGR |= ((i2sPrescaler / 2) << SPI_I2SCFGR_I2SDIV_Pos);
+	if constexpr ((i2sPrescaler & 1) != 0) {
+		SPI2->I2SCFGR |= SPI_I2SCFGR_ODD;
+	}
+#endif
 #ifdef I2S_PLL2P_CLK
 	// Use PLL2 clock - configured to 200MHz
 	RCC->D2CCIP1R |= RCC_D2CCIP1R_SPI123SEL_0;
@@ -446,7 +485,7 @@ void InitI2S()
 #endif
 
 #ifdef I2S_PER_CLK
-	// Use peripheral clock - configured to internal HSI at 64MHz
+	// Use peripheral clock - configured to internal HSI at 64MHz (47.6kHz: only approximates 48kHz)
 	RCC->D2CCIP1R |= RCC_D2CCIP1R_SPI123SEL_2;
 	SPI2->I2SCFGR |= (10 << SPI_I2SCFGR_I2SDIV_Pos);// Set I2SDIV to 10 with Odd factor prescaler
 	SPI2->I2SCFGR |= SPI_I2SCFGR_ODD;
@@ -466,8 +505,36 @@ void InitI2S()
 #endif
 #endif
 
-	// Enable interrupt when TxFIFO threshold reached, or underrun condition occurs
-	SPI2->IER |= (SPI_IER_TXPIE | SPI_IER_UDRIE);
+	// Audio samples are transferred by circular DMA from audioBuffer; half transfer and transfer complete interrupts render the idle half
+	RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
+	DMA1_Stream3->CR &= ~DMA_SxCR_EN;
+	DMA1_Stream3->CR |= DMA_SxCR_DIR_0;				// Direction: 00 = Peripheral-to-memory; 01 = Memory-to-peripheral
+	DMA1_Stream3->CR |= DMA_SxCR_CIRC;				// Circular mode to keep transmitting ping-pong buffer
+	DMA1_Stream3->CR |= DMA_SxCR_MINC;				// Memory in increment mode
+	DMA1_Stream3->CR |= DMA_SxCR_PSIZE_1;			// Peripheral size: 8 bit; 01 = 16 bit; 10 = 32 bit
+	DMA1_Stream3->CR |= DMA_SxCR_MSIZE_1;			// Memory size: 8 bit; 01 = 16 bit; 10 = 32 bit
+	DMA1_Stream3->CR |= DMA_SxCR_PL_1;				// Priority: 00 = low; 01 = Medium; 10 = High; 11 = Very High
+	DMA1_Stream3->CR |= DMA_SxCR_HTIE | DMA_SxCR_TCIE;	// Half transfer and transfer complete interrupts
+
+	DMA1_Stream3->FCR &= ~DMA_SxFCR_FTH;			// Disable FIFO Threshold selection
+	DMA1->LIFCR = 0x3F << DMA_LIFCR_CFEIF3_Pos;		// clear all five interrupts for this stream
+
+	DMAMUX1_Channel3->CCR |= 40; 					// DMA request MUX input 40 = spi2_tx_dma (See p.695)
+	DMAMUX1_ChannelStatus->CFR |= DMAMUX_CFR_CSOF3; // Channel 3 Clear synchronization overrun event flag
+
+	std::memset(audioBuffer, 0, sizeof(audioBuffer));	// .dma_buffer is not initialised: start with silence until first block is rendered
+	DMA1_Stream3->NDTR = audioBlockSize * 4;		// Number of 32 bit words to transfer (both halves of buffer)
+	DMA1_Stream3->PAR = reinterpret_cast<uint32_t>(&(SPI2->TXDR));
+	DMA1_Stream3->M0AR = reinterpret_cast<uint32_t>(audioBuffer);
+
+	NVIC_SetPriority(DMA1_Stream3_IRQn, 0x1);		// Lower is higher priority
+	NVIC_EnableIRQ(DMA1_Stream3_IRQn);
+
+	DMA1_Stream3->CR |= DMA_SxCR_EN;				// Enable DMA before enabling the SPI DMA request
+	SPI2->CFG1 |= SPI_CFG1_TXDMAEN;					// Tx DMA stream enable
+
+	// SPI interrupt only used to count underrun conditions
+	SPI2->IER |= SPI_IER_UDRIE;
 
 	NVIC_SetPriority(SPI2_IRQn, 0x1);				// Lower is higher priority
 	NVIC_EnableIRQ(SPI2_IRQn);
@@ -502,8 +569,9 @@ void InitDebugTimer()
 {
 	// Configure timer to use in internal debug timing
 	RCC->APB1LENR |= RCC_APB1LENR_TIM3EN;
+	// Timer clock is 200MHz / (PSC + 1) = 20MHz: 50ns per count, so 65535 counts covers ~3.2ms (a 128 frame block at 48kHz is 2.7ms)
 	TIM3->ARR = 65535;
-	TIM3->PSC = 1;
+	TIM3->PSC = 9;
 	TIM3->CR1 |= TIM_CR1_CEN;
 }
 
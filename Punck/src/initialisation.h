@@ -19,10 +19,20 @@ constexpr double pi = 3.14159265358979323846;
 constexpr float intToFloatMult = 1.0f / std::pow(2.0f, 31.0f);		// Multiple to convert 32 bit int to -1.0 - 1.0 float
 constexpr float floatToIntMult = std::pow(2.0f, 31.0f);				// Multiple to convert -1.0 - 1.0 float to 32 bit int
 
+// Sample rate is selected at build time (48kHz or 96kHz): I2S clock dividers and voice, reverb and sequencer timings are derived from it.
+// It is not switchable at run time as the reverb decimation, arena pool sizes and filter tables are constants sized for the rate
 static constexpr uint32_t systemSampleRate = 48000;
+static_assert(systemSampleRate == 48000 || systemSampleRate == 96000, "Sample rate must be 48kHz or 96kHz");
+static constexpr float sampleRateScale = systemSampleRate / 48000.0f;	// Voice rates and timings are specified per sample at 48kHz
 static constexpr float systemMaxFreq = 22000.0f;
 
+// Audio is rendered in blocks of stereo frames into a DMA ping-pong buffer: one half is rendered while the other is transmitted
+static constexpr uint32_t audioBlockSize = 32;
+static_assert(audioBlockSize >= 16 && audioBlockSize <= 128, "Audio block size must be between 16 and 128 frames");
+
 extern volatile uint16_t ADC_array[ADC1_BUFFER_LENGTH + ADC2_BUFFER_LENGTH];
+extern volatile uint16_t controlADC[ADC1_BUFFER_LENGTH + ADC2_BUFFER_LENGTH];	// Smoothed at control rate (see VoiceManager::SmoothADC)
+extern int32_t audioBuffer[audioBlockSize * 4];	// 2 halves * block size * 2 channels (interleaved left/right)
 extern uint32_t i2sUnderrun;					// Debug counter for I2S underruns
 
 // Define ADC array positions of various controls
@@ -53,6 +63,7 @@ enum channel {left = 0, right = 1};
 
 void InitClocks();
 void InitHardware();
+void InitFPU();
 void InitCache();
 void InitSysTick();
 void InitADC();
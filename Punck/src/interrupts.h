@@ -8,7 +8,16 @@ void OTG_FS_IRQHandler(void)
 uint32_t loopTime = 0, maxLoopTime = 0, outputTime = 0, maxOutputTime = 0, reverbTime = 0, maxReverbTime = 0;
 
 
-void SPI2_IRQHandler()									// I2S Interrupt
+void SPI2_IRQHandler()									// I2S Interrupt: only enabled for underrun detection
+{
+	if ((SPI2->SR & SPI_SR_UDR) == SPI_SR_UDR) {		// Check for Underrun condition
+		SPI2->IFCR |= SPI_IFCR_UDRC;					// Clear underrun condition
+		++i2sUnderrun;
+	}
+}
+
+
+void DMA1_Stream3_IRQHandler()							// I2S DMA Interrupt: fires when each half of audioBuffer has been transmitted
 {
 
 #if (TIMINGDEBUG)
@@ -19,13 +28,16 @@ void SPI2_IRQHandler()									// I2S Interrupt
 	TIM3->EGR |= TIM_EGR_UG;							// Re-initialize debug counter
 #endif
 
-	if ((SPI2->SR & SPI_SR_UDR) == SPI_SR_UDR) {		// Check for Underrun condition
-		SPI2->IFCR |= SPI_IFCR_UDRC;					// Clear underrun condition
+	const uint32_t flags = DMA1->LISR & (DMA_LISR_HTIF3 | DMA_LISR_TCIF3);
+	DMA1->LIFCR = DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTCIF3;
+
+	if (flags == (DMA_LISR_HTIF3 | DMA_LISR_TCIF3)) {	// Both halves sent before rendering caught up: a block has been missed
 		++i2sUnderrun;
-		return;
 	}
 
-	voiceManager.Output();
+	// Half transfer: first half has been sent so can be refilled; Transfer complete: refill second half
+	const uint32_t half = (flags & DMA_LISR_TCIF3) ? 1 : 0;
+	voiceManager.Output(&audioBuffer[half * audioBlockSize * 2]);
 
 #if (TIMINGDEBUG)
 	outputTime = TIM3->CNT;
@@ -4,6 +4,7 @@
 #include "VoiceManager.h"
 #include "FatTools.h"
 #include "Reverb.h"
+#include "NoiseGenerator.h"
 
 
 volatile uint32_t SysTickVal;		// 1 ms resolution
@@ -12,13 +13,22 @@ extern uint32_t SystemCoreClock;
 
 // Create DMA buffer that need to live in non-cached memory area
 volatile uint16_t __attribute__((section (".dma_buffer"))) ADC_array[ADC1_BUFFER_LENGTH + ADC2_BUFFER_LENGTH];
+int32_t __attribute__((section (".dma_buffer"))) audioBuffer[audioBlockSize * 4];		// I2S output ping-pong buffer
+volatile uint16_t controlADC[ADC1_BUFFER_LENGTH + ADC2_BUFFER_LENGTH];					// Pot and CV readings smoothed at control rate
 
 // Reverb delay lines are large so need to be placed in appropriate memory regions
 Reverb __attribute__((section (".ram_d2_data"))) reverb;
-float __attribute__((section (".ram_d1_data"))) reverbMixBuffer[94000];
+
+// Pools for buffers carved at run time (see MemoryArena.h). RAM_D1 holds the reverb feedback mixer at its largest size. RAM_D2 is
+// shared by the kick and toms hit caches (bottom) and the reverb diffusers (top), sized for full length caches with the default
+// diffuser count and never smaller than the maximum diffuser count. Extra diffusers shorten the caches: if they are configured
+// after the caches were allocated the caches give their memory back (see VoiceManager::IdleTasks)
+uint8_t __attribute__((section (".ram_d1_data"), aligned(8))) ramD1Pool[Reverb::mixerMemory];
+uint8_t __attribute__((section (".ram_d2_data"), aligned(8))) ramD2Pool[std::max<uint32_t>((Kick::cacheSize + Toms::cacheSize) * sizeof(float) + Reverb::defaultDiffuserMemory, Reverb::maxDiffuserMemory)];
+MemoryArena ramD1Arena{ramD1Pool, sizeof(ramD1Pool)};
+MemoryArena ramD2Arena{ramD2Pool, sizeof(ramD2Pool)};
 
 // TODO:
-// Sample panning (naming? web interface?)
 // Performance updates
 // Web editor: finish handling non-float values in config
 // Sample playback does not account for samples stored in discontinuous memory locations
@@ -33,10 +43,11 @@ int main(void) {
 
 	InitClocks();					// Configure the clock and PLL
 	InitHardware();
+	noiseGenerator.Seed();			// Seed voice noise generator from hardware RNG
 	extFlash.Init();				// Initialise external QSPI Flash
 	configManager.RestoreConfig();	// Restore configuration settings (voice config, MIDI mapping, drum sequences)
 	usb.Init(false);				// Pass false to indicate hard reset
-	InitI2S();						// Initialise I2S which will start main sample interrupts
+	InitI2S();						// Initialise I2S which will start DMA block interrupts
 
 	while (1) {
 		usb.cdc.ProcessCommand();	// Check for incoming USB serial commands
@@ -5,206 +5,344 @@
 
 #include "initialisation.h"
 #include "Filter.h"
+#include "Halfband.h"
+#include "MemoryArena.h"
 #include <cstring>
+#include <bit>
 
-extern float reverbMixBuffer[94000];
+// Delay line sample formats: samples are converted as they are written and read so 16 bit formats halve delay line memory
+struct DelayHalf {							// IEEE half precision bit pattern
+	uint16_t bits;
+};
+
+template<typename Storage>
+struct DelayStorage {						// 32 bit float: no conversion
+	static float Encode(const float x)		{ return x; }
+	static float Decode(const float s)		{ return s; }
+};
+
+template<>
+struct DelayStorage<int16_t> {				// Fixed point with +/-4 headroom, saturating
+	static constexpr float scale = 8192.0f;
+	static int16_t Encode(const float x)	{ return static_cast<int16_t>(std::clamp(x * scale, -32768.0f, 32767.0f)); }
+	static float Decode(const int16_t s)	{ return static_cast<float>(s) * (1.0f / scale); }
+};
+
+template<>
+struct DelayStorage<DelayHalf> {
+	// Half precision with the exponent bias offset so stored values cover 1.5e-8 to 16 without half precision subnormals: the
+	// conversion is a rebias of the float's exponent and rounded mantissa. Values below the range flush to zero, above saturate
+	static constexpr int32_t rebias = 100 << 10;			// Float exponent bias 127 - half exponent bias 15 - 12 (scale by 4096)
+
+	static DelayHalf Encode(const float x) {
+		const uint32_t bits = std::bit_cast<uint32_t>(x);
+		const int32_t magnitude = static_cast<int32_t>(((bits & 0x7FFFFFFF) + 0x1000) >> 13) - rebias;
+		return {static_cast<uint16_t>(((bits >> 16) & 0x8000) | std::clamp<int32_t>(magnitude, 0, 0x7BFF))};
+	}
+
+	static float Decode(const DelayHalf s) {
+		const uint32_t magnitude = s.bits & 0x7FFF;
+		const uint32_t bits = ((s.bits & 0x8000) << 16) | (magnitude != 0 ? (magnitude + rebias) << 13 : 0);
+		return std::bit_cast<float>(bits);
+	}
+};
+
+
+// The send bus is low pass filtered before the reverb so the diffusers and feedback mixer run at a reduced sample rate, halving
+// (or quartering) their processing and delay line memory. Sample rate is reduced with cascaded halfband filters
+static constexpr uint32_t reverbDecimation = (systemSampleRate == 96000) ? 4 : 2;		// 1, 2 or 4
+static_assert(reverbDecimation == 1 || reverbDecimation == 2 || reverbDecimation == 4, "Reverb decimation must be 1, 2 or 4");
+static_assert(audioBlockSize % reverbDecimation == 0, "Audio block size must be a multiple of the reverb decimation");
+static constexpr uint32_t reverbSampleRate = systemSampleRate / reverbDecimation;
+
+// Delay line sample format of each stage: float, int16_t or DelayHalf. Half precision error stays around 70dB below the signal
+// throughout the tail; int16 has a fixed noise floor near -70dBFS (relative to the send bus) and truncates the end of the tail
+using ReverbDiffuserSample = float;
+using ReverbMixerSample = DelayHalf;
 
+// Delay lines are processed a block at a time in contiguous segments, so the position wraps at most once per block rather than
+// being tested every sample. Delay is size - 1 samples. Read and Write require a delay longer than the block so every sample
+// read was written in an earlier block; Exchange handles any length
+template<typename Storage = float>
 struct DelayLines {
-	float* delay;							// pointer to location of samples in delay buffer
-	size_t size;							// size of delay buffer
+	using Format = DelayStorage<Storage>;
+	Storage* delay;							// pointer to location of samples in delay buffer
+	uint32_t size;							// size of delay buffer
 	uint32_t writePos;						// current sample write position
-	uint32_t readPos;						// current sample read position
 
-	void write(float sample) {
-		delay[writePos++] = sample;
-		if (writePos == size) writePos = 0;
-		readPos = writePos + 1;				// delay length is constant so always one past the write position
-		if (readPos == size) readPos = 0;
+	void Read(float* out, const uint32_t frames) {
+		// Read the oldest samples: must be called before writing the block
+		const uint32_t readPos = (writePos + 1 == size) ? 0 : writePos + 1;
+		const uint32_t first = std::min(frames, size - readPos);
+		const Storage* r = &delay[readPos];
+		for (uint32_t i = 0; i < first; ++i) {
+			out[i] = Format::Decode(r[i]);
+		}
+		for (uint32_t i = first; i < frames; ++i) {
+			out[i] = Format::Decode(delay[i - first]);
+		}
+	}
+
+	void Write(const float* in, const uint32_t frames) {
+		const uint32_t first = std::min(frames, size - writePos);
+		Storage* w = &delay[writePos];
+		for (uint32_t i = 0; i < first; ++i) {
+			w[i] = Format::Encode(in[i]);
+		}
+		for (uint32_t i = first; i < frames; ++i) {
+			delay[i - first] = Format::Encode(in[i]);
+		}
+		writePos += frames;
+		if (writePos >= size) writePos -= size;
+	}
+
+	void Exchange(float* block, const uint32_t frames) {
+		// Replace a block of input samples with the delayed samples and store the input
+		uint32_t i = 0;
+		while (i < frames) {
+			const uint32_t readPos = (writePos + 1 == size) ? 0 : writePos + 1;
+			const uint32_t count = std::min({frames - i, size - writePos, size - readPos});
+			const Storage* r = &delay[readPos];
+			Storage* w = &delay[writePos];
+			float* b = &block[i];
+			for (uint32_t s = 0; s < count; ++s) {
+				const float out = Format::Decode(r[s]);		// Read position is one ahead of the write position so is read first
+				w[s] = Format::Encode(b[s]);
+				b[s] = out;
+			}
+			i += count;
+			writePos += count;
+			if (writePos == size) writePos = 0;
+		}
 	}
 };
 
 
-// Usage: `Householder<double, 8>::inPlace(data)` - size must be ≥ 1
+// Reverb stages operate in place on a block of samples per channel
+using ReverbBlock = float[audioBlockSize];
+
+
+// Usage: `Householder<8>::InPlace(data, frames)` - size must be ≥ 1
 template<uint32_t size>
 class Householder {
 	static constexpr float multiplier = -2.0f / size;
 public:
-	static void InPlace(float* arr) {
-		float sum = 0.0f;
-		for (uint32_t i = 0; i < size; ++i) {
-			sum += arr[i];
+	static void InPlace(ReverbBlock* data, const uint32_t frames) {
+		float sum[audioBlockSize];
+		for (uint32_t f = 0; f < frames; ++f) {
+			sum[f] = data[0][f];
+		}
+		for (uint32_t c = 1; c < size; ++c) {
+			for (uint32_t f = 0; f < frames; ++f) {
+				sum[f] += data[c][f];
+			}
 		}
 
-		sum *= multiplier;
+		for (uint32_t f = 0; f < frames; ++f) {
+			sum[f] *= multiplier;
+		}
 
-		for (uint32_t i = 0; i < size; ++i) {
-			arr[i] += sum;
+		for (uint32_t c = 0; c < size; ++c) {
+			for (uint32_t f = 0; f < frames; ++f) {
+				data[c][f] += sum[f];
+			}
 		}
 	};
 };
 
 
-// Usage: `Hadamard<float, 8>::inPlace(data)` - size must be a power of 2
-template<typename Sample, int size>
+// Usage: `Hadamard<8>::InPlace(data, frames, scale)` - size must be a power of 2
+template<uint32_t size>
 class Hadamard {
 public:
-	static inline void RecursiveUnscaled(Sample* data) {
-		if (size <= 1) {
-			return;
-		}
-		constexpr uint32_t hSize = size / 2;
-
-		// Two (unscaled) Hadamards of half the size
-		Hadamard<Sample, hSize>::RecursiveUnscaled(data);
-		Hadamard<Sample, hSize>::RecursiveUnscaled(data + hSize);
-
-		// Combine the two halves using sum/difference
-		for (uint32_t i = 0; i < hSize; ++i) {
-			float a = data[i];
-			float b = data[i + hSize];
-			data[i] = a + b;
-			data[i + hSize] = a - b;
+	static inline void RecursiveUnscaled(ReverbBlock* data, const uint32_t frames) {
+		if constexpr (size > 1) {
+			constexpr uint32_t hSize = size / 2;
+
+			// Two (unscaled) Hadamards of half the size
+			Hadamard<hSize>::RecursiveUnscaled(data, frames);
+			Hadamard<hSize>::RecursiveUnscaled(data + hSize, frames);
+
+			// Combine the two halves using sum/difference
+			for (uint32_t i = 0; i < hSize; ++i) {
+				for (uint32_t f = 0; f < frames; ++f) {
+					const float a = data[i][f];
+					const float b = data[i + hSize][f];
+					data[i][f] = a + b;
+					data[i + hSize][f] = a - b;
+				}
+			}
 		}
 	}
 
-	static inline void inPlace(Sample* data) {
-		RecursiveUnscaled(data);
+	static inline void InPlace(ReverbBlock* data, const uint32_t frames, const float (&scale)[size]) {
+		// Output channels are multiplied by scale in the final sum/difference stage (normalisation and polarity)
+		constexpr uint32_t hSize = size / 2;
+		Hadamard<hSize>::RecursiveUnscaled(data, frames);
+		Hadamard<hSize>::RecursiveUnscaled(data + hSize, frames);
 
-		Sample scalingFactor = std::sqrt(1.0 / size);
-		for (uint32_t c = 0; c < size; ++c) {
-			data[c] *= scalingFactor;
+		for (uint32_t i = 0; i < hSize; ++i) {
+			const float scaleA = scale[i];
+			const float scaleB = scale[i + hSize];
+			for (uint32_t f = 0; f < frames; ++f) {
+				const float a = data[i][f];
+				const float b = data[i + hSize][f];
+				data[i][f] = (a + b) * scaleA;
+				data[i + hSize][f] = (a - b) * scaleB;
+			}
 		}
 	}
 };
 
 
 
-template<int channels = 8>
+template<int channels = 8, typename Storage = float>
 class DiffuserStep {
 public:
 
 	DiffuserStep()
 	{
-		memset(delayBuffer, 0, sizeof(delayBuffer));			// Clear delay line buffer
-		delays[0].delay = &delayBuffer[0];
+		const float hadamardScale = std::sqrt(1.0f / channels);
 
-		// Generate array of randomised delay lengths distributed semi-evenly across the diffusion time
+		// Generate array of randomised delay lengths distributed semi-evenly across the diffusion time. Each delay line will be a
+		// random length partitioned thusly (for 8 channels with a delay range of 50ms at 48kHz):
+		// | 0 - 300 | 300 - 600 | 600 - 900 | 900 - 1200 | 1200 - 1500 | 1500 - 1800 | 1800 - 2100 | 2100 - 2400 |
 		for (uint32_t i = 0; i < channels; ++i) {
 			const float rangeLow = delaySamplesRange * i / channels;
 			const float rangeHigh = delaySamplesRange * (i + 1) / channels;
-			delays[i].size = std::max(static_cast<uint32_t>(rangeLow +  (rand() / float(RAND_MAX)) * (rangeHigh - rangeLow)), 10UL);
+			delays[i].size = std::max<uint32_t>(static_cast<uint32_t>(rangeLow +  (rand() / float(RAND_MAX)) * (rangeHigh - rangeLow)), 10);
 
-			// Set the start pointer to the start of the current delay line within the combined delay buffer
-			if (i < channels) {
-				delays[i + 1].delay = delays[i].delay + delays[i].size;
-			}
-			delays[i].writePos = 0;
+			// Hadamard normalisation and randomised polarity flips are applied together in the final mixing stage
+			mixScale[i] = (rand() & 1) ? -hadamardScale : hadamardScale;
+		}
+	}
+
+
+	bool Allocate(MemoryArena& arena)		// Carve the delay lines from the top of the arena: returns false if there is no space
+	{
+		uint32_t total = 0;
+		for (uint32_t i = 0; i < channels; ++i) {
+			total += delays[i].size;
+		}
+		Storage* buffer = arena.AllocateTop<Storage>(total);
+		if (buffer == nullptr) {
+			return false;
+		}
+		memset(buffer, 0, total * sizeof(Storage));			// Clear delay line buffer
 
-			flipPolarity[i] = (rand() & 1);
+		for (uint32_t i = 0; i < channels; ++i) {
+			delays[i].delay = buffer;
+			delays[i].writePos = 0;
+			buffer += delays[i].size;
 		}
+		return true;
 	}
 
 
-	std::array<float, channels> Process(const std::array<float, channels>& input)
+	void Clear()											// Silence delay lines
 	{
-		std::array<float, channels> output;
 		for (uint32_t c = 0; c < channels; ++c) {
-			delays[c].write(input[c]);							// Write current sample into delay line
-			output[c] = delays[c].delay[delays[c].readPos];		// Read out oldest delayed sample
+			memset(delays[c].delay, 0, delays[c].size * sizeof(Storage));
+			delays[c].writePos = 0;
 		}
+	}
 
-		Hadamard<float, channels>::inPlace(output.data());		// Mix with a Hadamard matrix
 
-		for (uint32_t c = 0; c < channels; ++c) {				// Flip polarities according to randomised table
-			if (flipPolarity[c]) {
-				output[c] *= -1;
-			}
+	void Process(ReverbBlock* samples, const uint32_t frames)
+	{
+		for (uint32_t c = 0; c < channels; ++c) {
+			delays[c].Exchange(samples[c], frames);				// Replace block with oldest delayed samples
 		}
-		return output;
+
+		Hadamard<channels>::InPlace(samples, frames, mixScale);	// Mix with a Hadamard matrix
 	}
 
-private:
 	static constexpr float delayMsRange = 50;
-	static constexpr float delaySamplesRange = delayMsRange * 0.001 * systemSampleRate;		// 2400 at 48kHz
+	static constexpr float delaySamplesRange = delayMsRange * 0.001 * reverbSampleRate;		// 1200 at 24kHz
 
-	// Create a buffer to hold delay samples - the length of each delay line randomised but grouped in ascending sizes
-	// For 8 channels with a delay range of 50ms this means each delay line will a random number partitioned thusly:
-	// | 0 - 300 | 300 - 600 | 600 - 900 | 900 - 1200 | 1200 - 1500 | 1500 - 1800 | 1800 - 2100 | 2100 - 2400 |
-	float delayBuffer[static_cast<uint32_t>(delaySamplesRange * (channels + 1) / 2)];
+	// Largest allocation in bytes: total length of the delay lines is at most the sum of the upper limit of each partition
+	static constexpr uint32_t maxMemory = static_cast<uint32_t>(delaySamplesRange * (channels + 1) / 2) * sizeof(Storage) + alignof(Storage);
 
-	// Hold randomised list of channels to flip polarity of when mixing
-	std::array<bool, channels> flipPolarity;
+private:
+
+	// Output scaling of each channel when mixing: Hadamard normalisation with randomised polarity
+	float mixScale[channels];
 
-	DelayLines delays[channels];
+	DelayLines<Storage> delays[channels];
 };
 
 
 
 class Reverb;
 
-template<int channels = 8>
+template<int channels = 8, typename Storage = float>
 class MixedFeedback {
 	friend Reverb;
 public:
-	MixedFeedback()
+	bool Allocate(MemoryArena& arena, const uint32_t lines, const float delayMs)
 	{
-		memset(reverbMixBuffer, 0, sizeof(reverbMixBuffer));		// Clear delay line buffer
-		delays[0].delay = reverbMixBuffer;
-
-		// Generate arrays within delay buffer of increasing delay lengths distributed up from baseDelayLength
-		for (uint32_t i = 0; i < channels; ++i) {
-			float r = static_cast<float>(i) / channels;
-			delays[i].size = static_cast<uint32_t>(std::pow(2.0f, r) * baseDelayLength);
-
-			// Set the start pointer to the start of the current delay line within the combined delay buffer
-			if (i < channels) {
-				delays[i + 1].delay = delays[i].delay + delays[i].size;
-			}
+		// Carve the first lines delay lines from the top of the arena with lengths increasing from the base delay: returns false
+		// if there is no space. Contents are not cleared (see Reverb::AllocateMixer)
+		const float baseLength = delayMs * 0.001f * reverbSampleRate;		// 150 * .001 * 24000 = 3600
+		uint32_t total = 0;
+		for (uint32_t i = 0; i < lines; ++i) {
+			const float r = static_cast<float>(i) / channels;
+			delays[i].size = static_cast<uint32_t>(std::pow(2.0f, r) * baseLength);
+			total += delays[i].size;
+		}
+		Storage* buffer = arena.AllocateTop<Storage>(total);
+		if (buffer == nullptr) {
+			return false;
+		}
+		for (uint32_t i = 0; i < lines; ++i) {
+			delays[i].delay = buffer;
 			delays[i].writePos = 0;
-			delays[i].readPos = 1;
+			buffer += delays[i].size;
 		}
+		return true;
 	}
 
-
-	void SetDelay(float delay) {
-		// Update the size of the delay lines without changing the pointer start positions
-		if (delay != delayMs) {
-			delayMs = delay;
-			for (uint32_t i = 0; i < channels; ++i) {
-				const float baseLength = delay * 0.001f * systemSampleRate;		// 150 * .001 * 48000 = 7200
-				float r = static_cast<float>(i) / channels;
-				delays[i].size = static_cast<uint32_t>(std::pow(2.0f, r) * baseLength);
-				delays[i].writePos = 0;
-				delays[i].readPos = 1;
-			}
+	void Clear(const uint32_t first, const uint32_t last)			// Silence delay lines first to last - 1
+	{
+		for (uint32_t c = first; c < last; ++c) {
+			memset(delays[c].delay, 0, delays[c].size * sizeof(Storage));
+			delays[c].writePos = 0;
 		}
 	}
 
-	std::array<float, channels> Process(const std::array<float, channels>& input)
+
+	template<uint32_t active = channels>
+	void Process(ReverbBlock* samples, const uint32_t frames)
 	{
-		std::array<float, channels> output;
-		for (uint32_t c = 0; c < channels; ++c) {
-			output[c] = delays[c].delay[delays[c].readPos];			// Read out oldest delayed sample
+		// Only the first active delay lines are processed: running fewer channels reduces the density of the tail and the CPU load
+		for (uint32_t c = 0; c < active; ++c) {
+			delays[c].Read(feedback[c], frames);					// Read out oldest delayed samples
 		}
 
-		Householder<channels>::InPlace(output.data());				// Mix using a Householder matrix
+		Householder<active>::InPlace(feedback, frames);				// Mix using a Householder matrix
 
-		for (uint32_t c = 0; c < channels; ++c) {
-			float sum = input[c] + output[c] * decayGain;
-			delays[c].write(sum);									// Write current sample into delay line
+		for (uint32_t c = 0; c < active; ++c) {
+			// Input plus decayed feedback is written into the delay line; the mixed feedback replaces the input as the output
+			for (uint32_t f = 0; f < frames; ++f) {
+				const float mixed = feedback[c][f];
+				feedback[c][f] = samples[c][f] + mixed * decayGain;
+				samples[c][f] = mixed;
+			}
+			delays[c].Write(feedback[c], frames);
 		}
-		return output;
 	}
 
 
+	// Largest allocation in bytes: all lines at the maximum base delay of 150ms up to 48kHz (75ms at 96kHz). Total length of 8 lines
+	// is just over 11 times the base delay
+	static constexpr float maxDelayMs = (reverbSampleRate > 48000) ? 75.0f : 150.0f;
+	static constexpr uint32_t maxMemory = static_cast<uint32_t>(11.1f * maxDelayMs * 0.001f * reverbSampleRate) * sizeof(Storage) + alignof(Storage);
+
 private:
-	static constexpr float maxDelayMs = 150.0f;						// Sets size of delay buffer
 	static constexpr float decayGain = 0.75f;
-	static constexpr float baseDelayLength = maxDelayMs * 0.001f * systemSampleRate;		// 150 * .001 * 48000 = 7200
-
-	float delayMs = maxDelayMs;
 
-	DelayLines delays[channels];
+	DelayLines<Storage> delays[channels];
+	ReverbBlock feedback[channels];									// Mixed delay line output
 };
 
 
@@ -213,33 +351,99 @@ class Reverb {
 public:
 	Reverb()
 	{
-		filter.SetCutoff(config.filterCutoff);
+		filter.SetCutoff(config.filterCutoff / (systemSampleRate / 2));
 	}
 
 
-	std::pair<float, float> Process(float sampleL, float sampleR) {
-		sampleL = filter.CalcFilter(sampleL, channel::left);
-		sampleR = filter.CalcFilter(sampleR, channel::right);
-		std::array<float, delayChannels> samples {sampleL, sampleR, sampleL, sampleR, sampleL, sampleR, sampleL, sampleR};
+	void FilterInput(float* inL, float* inR, const uint32_t frames)		// Low pass filter a block of send bus input before processing
+	{
+		filter.Process(inL, inR, frames);
+	}
 
-		// Generate short diffusion
-		for (uint8_t i = 0; i < config.diffuserCount; ++i) {
-			samples = diffuserStep[i].Process(samples);
+
+	void Process(float* bufferL, float* bufferR, const uint32_t frames)		// Replace a block of filtered send bus input with reverb output
+	{
+		if (!allocated) {													// Delay lines are being carved for a new configuration
+			std::fill(bufferL, &bufferL[frames], 0.0f);
+			std::fill(bufferR, &bufferR[frames], 0.0f);
+			return;
+		}
+
+		// Once the tail has decayed below the silence threshold the stages are bypassed until the input is no longer silent.
+		// Delay lines then hold only sub-threshold samples so processing resumes without a click
+		const bool silentInput = Peak(bufferL, frames) < silenceLevel && Peak(bufferR, frames) < silenceLevel;
+		if (!silentInput) {
+			silentFrames = 0;
+			bypassed = false;
+		} else if (bypassed) {
+			std::fill(bufferL, &bufferL[frames], 0.0f);
+			std::fill(bufferR, &bufferR[frames], 0.0f);
+			return;
 		}
 
+		// Reduce the input sample rate in place then spread left and right inputs alternately across the delay channels
+		uint32_t reducedFrames = frames;
+		for (uint32_t s = 0; s < resampleStages; ++s) {
+			decimator[left][s].Process(bufferL, bufferL, reducedFrames);
+			decimator[right][s].Process(bufferR, bufferR, reducedFrames);
+			reducedFrames /= 2;
+		}
+
+		for (uint32_t c = 0; c < delayChannels; ++c) {
+			const float* in = (c & 1) ? bufferR : bufferL;
+			std::copy(in, &in[reducedFrames], samples[c]);
+		}
+
+		// Generate short diffusion (CPU governor may limit the number of diffusers)
+		const uint32_t diffusers = std::min(activeDiffusers, diffuserLimit);
+		for (uint32_t i = diffusersRun; i < diffusers; ++i) {
+			diffuserStep[i].Clear();						// Frozen while limited by the governor: clear rather than replay old audio
+		}
+		diffusersRun = diffusers;
+		for (uint8_t i = 0; i < diffusers; ++i) {
+			diffuserStep[i].Process(samples, reducedFrames);
+		}
+		bool silentTail = silentInput && Peak(samples, reducedFrames) < silenceLevel;		// Diffuser output
+
 		// Generate long tails with feedback mixer
-		if (mixerChannels > 0.0f) {
-			samples = feedbackMixer.Process(samples);
+		const bool fourChannel = (activeMixerChannels == 4 || (activeMixerChannels == 8 && reducedMixer));
+		if (fourChannel) {
+			feedbackMixer.Process<4>(samples, reducedFrames);
+			upperLinesStale = (activeMixerChannels == 8);
+		} else if (activeMixerChannels > 0) {
+			if (upperLinesStale) {
+				// Lines 4 - 7 were frozen while the CPU governor ran a 4 channel mixer: clear rather than replay the old tail
+				feedbackMixer.Clear(4, 8);
+				upperLinesStale = false;
+			}
+			feedbackMixer.Process(samples, reducedFrames);
 		}
 
-		if (mixerChannels == 4.0f) {
-			return {(samples[0] + samples[2]) * config.reverbLevel,
-				    (samples[1] + samples[3]) * config.reverbLevel};
+		// Bypass once diffuser and mixer outputs have been silent for longer than the longest delay path so no stored sample is
+		// above the threshold (the mixing matrices preserve energy so a silent output means silent delay line reads)
+		silentTail = silentTail && Peak(samples, reducedFrames) < silenceLevel;
+		silentFrames = silentTail ? silentFrames + reducedFrames : 0;
+		bypassed = silentFrames > tailFrames;
+
+		const float level = config.reverbLevel;
+		if (fourChannel) {
+			for (uint32_t f = 0; f < reducedFrames; ++f) {
+				bufferL[f] = (samples[0][f] + samples[2][f]) * level;
+				bufferR[f] = (samples[1][f] + samples[3][f]) * level;
+			}
 		} else {
-			return {(samples[0] + samples[2] + samples[4] + samples[6]) * config.reverbLevel,
-				    (samples[1] + samples[3] + samples[5] + samples[7]) * config.reverbLevel};
+			for (uint32_t f = 0; f < reducedFrames; ++f) {
+				bufferL[f] = (samples[0][f] + samples[2][f] + samples[4][f] + samples[6][f]) * level;
+				bufferR[f] = (samples[1][f] + samples[3][f] + samples[5][f] + samples[7][f]) * level;
+			}
 		}
 
+		// Restore the output sample rate in place
+		for (uint32_t s = 0; s < resampleStages; ++s) {
+			interpolator[left][s].Process(bufferL, bufferL, reducedFrames);
+			interpolator[right][s].Process(bufferR, bufferR, reducedFrames);
+			reducedFrames *= 2;
+		}
 	}
 
 	uint32_t SerialiseConfig(uint8_t** buff)
@@ -261,27 +465,172 @@ public:
 		if ((config.mixerChannels == 0.0f || config.mixerChannels == 4.0f || config.mixerChannels == 8.0f)) {
 			mixerChannels = static_cast<uint32_t>(config.mixerChannels);
 		}
-		feedbackMixer.SetDelay(config.mixerBaseDelay);
+		config.filterCutoff = std::clamp(std::round(config.filterCutoff), 100.0f, maxFilterCutoff);
 		filter.SetCutoff(config.filterCutoff / (systemSampleRate / 2));
 
+		config.silenceThreshold = std::clamp(config.silenceThreshold, -140.0f, -40.0f);
+		silenceLevel = std::pow(10.0f, config.silenceThreshold / 20.0f);
+
+		// Delay lines are only carved again if the reverb size has changed. This may be called from the USB interrupt so carving
+		// is left to the idle loop (see UpdateAllocation)
+		const uint32_t diffusers = static_cast<uint32_t>(config.diffuserCount);
+		if (!allocated || diffusers != allocatedDiffusers || mixerChannels != allocatedMixerChannels || config.mixerBaseDelay != allocatedDelay) {
+			pendingAllocation = true;
+		}
+		silentFrames = 0;
+		bypassed = false;
+
 		return sizeof(config);
 	}
 
-private:
+
+	void UpdateAllocation()									// Idle loop: carve delay lines for a changed configuration
+	{
+		if (!pendingAllocation) {
+			return;
+		}
+		pendingAllocation = false;
+		__DMB();											// A configuration stored after this point sets pendingAllocation again
+
+		const uint32_t diffusers = static_cast<uint32_t>(config.diffuserCount);
+		const uint32_t channels = mixerChannels;
+		const float delayMs = config.mixerBaseDelay;
+		const bool newDiffusers = !allocated || diffusers != allocatedDiffusers || diffusersShort;
+		const bool newMixer = !allocated || channels != allocatedMixerChannels || delayMs != allocatedDelay;
+		if (!newDiffusers && !newMixer) {
+			return;
+		}
+
+		allocated = false;
+		__DMB();											// Audio interrupt must see the reverb disabled before delay lines change
+		if (newDiffusers) {
+			AllocateDiffusers(diffusers);
+		}
+		if (newMixer) {
+			AllocateMixer(channels, delayMs);
+		}
+		const uint32_t diffuserDelay = activeDiffusers * DiffuserStep<delayChannels, ReverbDiffuserSample>::delaySamplesRange;
+		const uint32_t mixerDelay = (activeMixerChannels > 0) ? feedbackMixer.delays[activeMixerChannels - 1].size : 0;
+		tailFrames = std::max(mixerDelay, diffuserDelay);
+		__DMB();											// Delay lines must be stored before the reverb is enabled
+		allocated = true;
+
+		// Report the diffusers actually running unless the hit caches are about to give back space for the rest
+		if (activeDiffusers < diffusers && !diffusersShort) {
+			__disable_irq();								// Not if a new configuration was stored while carving
+			if (!pendingAllocation) {
+				config.diffuserCount = static_cast<float>(activeDiffusers);
+				allocatedDiffusers = activeDiffusers;
+			}
+			__enable_irq();
+		}
+	}
+
+
+	bool DiffusersShort()		{ return diffusersShort; }		// Configured diffusers did not fit beside the RAM_D2 hit caches
+	void RequestAllocation()	{ pendingAllocation = true; }	// Carve again (eg after the hit caches have released space)
+
 	static constexpr uint32_t maxDiffusers = 3;
+	static constexpr uint32_t defaultDiffusers = 2;
+	static constexpr float maxFilterCutoff = 0.3f * reverbSampleRate;		// Halfband passband edge of the last decimation stage
 	static constexpr uint32_t delayChannels = 8;
 
-	DiffuserStep<delayChannels> diffuserStep[maxDiffusers];
-	MixedFeedback<delayChannels> feedbackMixer;
-	Filter<2> filter{filterPass::LowPass, nullptr};
-	uint32_t mixerChannels = 8;
+	// Arena pool sizes (see main.cpp): largest feedback mixer; diffusers for the default and largest configurations
+	static constexpr uint32_t defaultDiffuserMemory = defaultDiffusers * DiffuserStep<delayChannels, ReverbDiffuserSample>::maxMemory;
+	static constexpr uint32_t maxDiffuserMemory = maxDiffusers * DiffuserStep<delayChannels, ReverbDiffuserSample>::maxMemory;
+	static constexpr uint32_t mixerMemory = MixedFeedback<delayChannels, ReverbMixerSample>::maxMemory;
+
+	// Quality limits set by the CPU governor: these override the stored configuration without changing it
+	uint32_t diffuserLimit = maxDiffusers;					// Maximum number of diffusers to process
+	bool reducedMixer = false;								// Run an 8 channel feedback mixer with 4 channels
+
+private:
+	static constexpr uint32_t resampleStages = (reverbDecimation == 4) ? 2 : (reverbDecimation == 2) ? 1 : 0;
+	HalfbandDecimator<> decimator[2][std::max<uint32_t>(resampleStages, 1)];		// Left and right channel of each stage
+	HalfbandInterpolator<> interpolator[2][std::max<uint32_t>(resampleStages, 1)];
+
+	ReverbBlock samples[delayChannels];						// Block passed through each stage in place
+	DiffuserStep<delayChannels, ReverbDiffuserSample> diffuserStep[maxDiffusers];
+	MixedFeedback<delayChannels, ReverbMixerSample> feedbackMixer;
+	Filter<filterPass::LowPass> filter{nullptr};
+	uint32_t mixerChannels = 8;								// Configured feedback mixer channels
+	bool upperLinesStale = false;							// Mixer lines 4 - 7 hold audio frozen while running with 4 channels
+	uint32_t diffusersRun = 0;								// Diffusers processed in the last block: any above this are stale
+
+	volatile bool allocated = false;						// Delay lines have been carved for the current configuration
+	volatile bool pendingAllocation = false;				// Configuration has changed size: carved by UpdateAllocation
+	bool diffusersShort = false;							// Fewer diffusers fitted than configured while the arena bottom was in use
+	uint32_t activeDiffusers = 0;							// Diffusers and mixer channels for which there was space in the arenas
+	uint32_t activeMixerChannels = 0;
+	uint32_t allocatedDiffusers = 0;						// Configuration the delay lines were carved for
+	uint32_t allocatedMixerChannels = 0;
+	float allocatedDelay = 0.0f;
+
+	void AllocateDiffusers(const uint32_t diffusers)
+	{
+		// Carve diffuser delay lines from the top of the RAM_D2 arena, which is shared with the kick and toms hit caches allocated
+		// from the bottom: diffusers that do not fit in the space left are disabled until the caches have released their memory
+		ramD2Arena.ReleaseTop();
+		activeDiffusers = 0;
+		while (activeDiffusers < diffusers && diffuserStep[activeDiffusers].Allocate(ramD2Arena)) {
+			++activeDiffusers;
+		}
+		diffusersShort = activeDiffusers < diffusers && ramD2Arena.BottomUsed() > 0;
+		diffusersRun = activeDiffusers;						// Newly carved delay lines are already clear
+		allocatedDiffusers = diffusers;
+	}
+
+
+	void AllocateMixer(const uint32_t channels, const float delayMs)
+	{
+		// Mixer lines are carved down from the top of the RAM_D1 arena so resized lines overlap the previous ones: when the base
+		// delay changes the old tail carries on at the new lengths rather than being muted. Only memory that was not part of the
+		// previous lines is cleared
+		const uint32_t previousBytes = ramD1Arena.TopUsed();
+		ramD1Arena.ReleaseTop();
+		activeMixerChannels = channels;
+		while (activeMixerChannels > 0 && !feedbackMixer.Allocate(ramD1Arena, activeMixerChannels, delayMs)) {
+			activeMixerChannels -= 4;										// Fall back to a 4 channel mixer if 8 will not fit
+		}
+		const uint32_t usedBytes = ramD1Arena.TopUsed();
+		if (usedBytes > previousBytes) {
+			memset(feedbackMixer.delays[0].delay, 0, usedBytes - previousBytes);
+		}
+		upperLinesStale = false;
+		allocatedMixerChannels = channels;
+		allocatedDelay = delayMs;
+	}
+
+	float silenceLevel = 0.0f;								// Linear silence threshold
+	uint32_t tailFrames = 0;								// Longest path through the diffusers or feedback mixer
+	uint32_t silentFrames = 0;								// Frames since input and tail fell below the silence threshold
+	bool bypassed = false;									// Reverb tail has decayed: stages are not processed
+
+	static float Peak(const float* buffer, const uint32_t frames)
+	{
+		float peak = 0.0f;
+		for (uint32_t i = 0; i < frames; ++i) {
+			peak = std::max(peak, std::abs(buffer[i]));
+		}
+		return peak;
+	}
+
+	static float Peak(const ReverbBlock* buffer, const uint32_t frames)
+	{
+		float peak = 0.0f;
+		for (uint32_t c = 0; c < delayChannels; ++c) {
+			peak = std::max(peak, Peak(buffer[c], frames));
+		}
+		return peak;
+	}
 
 	struct Config {
 		float reverbLevel = 0.01f;							// Wet reverb Level
 		float mixerBaseDelay = 75.0f;						// Starting delay of feedback mixer
-		float diffuserCount = 2.0f;							// Number of active diffusers
+		float diffuserCount = defaultDiffusers;				// Number of active diffusers
 		float mixerChannels = 8.0f;							// 0, 4 or 8 feedback mixer channels
 		float filterCutoff = 2400.0f;						// Cutoff in Hertz
+		float silenceThreshold = -96.0f;					// Level (dBFS on the send bus) below which the decayed tail is bypassed
 	} config;
 };
 
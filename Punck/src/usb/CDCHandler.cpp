@@ -5,6 +5,8 @@
 #include "FatTools.h"
 #include "Samples.h"
 #include "VoiceManager.h"
+#include "CpuGovernor.h"
+#include "MemoryArena.h"
 #include "ff.h"
 
 uint32_t flashBuff[8192];
@@ -105,6 +107,12 @@ void CDCHandler::ProcessCommand()
 				"samplelist  -  Show details of all samples found in flash\r\n"
 				"midimap     -  Display MIDI note mapping\r\n"
 				"midichn:x   -  Set MIDI channel (0 = omni)\r\n"
+				"polyphony   -  Display polyphony of snare, toms, claps and samples\r\n"
+				"memory      -  Display usage of RAM_D1 and RAM_D2 allocation pools\r\n"
+				"snarepoly:x -  Set snare polyphony (1-4)\r\n"
+				"tomspoly:x  -  Set toms polyphony (1-4)\r\n"
+				"clapspoly:x -  Set claps polyphony (1-3)\r\n"
+				"samplepoly:x   Set polyphony of each sample player (1-3)\r\n"
 				"reboot      -  Reboot device\r\n"
 				"leds:x      -  Set all LEDs to brightness from 1-100%\r\n"
 				"revertleds  -  Reset all LEDs\r\n"
@@ -136,7 +144,7 @@ void CDCHandler::ProcessCommand()
 
 	} else if (cmd.compare("timing") == 0) {					// Print timing debug info
 #if (TIMINGDEBUG)
-		printf("Timings: Loop: %ld, Max: %ld, Output: %ld, Max: %ld, Underrun: %ld\r\n",
+		printf("Timings (50ns counts): Loop: %ld, Max: %ld, Output: %ld, Max: %ld, Underrun: %ld\r\n",
 				loopTime, maxLoopTime, outputTime, maxOutputTime, i2sUnderrun);
 		for (auto note : voiceManager.noteMapper) {
 			switch (note.voice) {
@@ -161,6 +169,9 @@ void CDCHandler::ProcessCommand()
 			case VoiceManager::claps:
 				printf("Claps   ");
 				break;
+			case VoiceManager::ride:
+				printf("Ride    ");
+				break;
 			}
 			printf(": %ld\r\n", note.drumVoice->debugMaxTime);
 		}
@@ -168,6 +179,12 @@ void CDCHandler::ProcessCommand()
 #else
 		printf("I2C Underrun: %ld\r\n", i2sUnderrun);
 #endif
+		printf("Note queue overflow: USB: %ld, Serial: %ld, Sequencer: %ld, Trigger: %ld\r\n",
+				voiceManager.noteQueue[VoiceManager::usbMidiSource].overflow, voiceManager.noteQueue[VoiceManager::serialMidiSource].overflow,
+				voiceManager.noteQueue[VoiceManager::sequencerSource].overflow, voiceManager.noteQueue[VoiceManager::triggerSource].overflow);
+		printf("CPU governor: Level %d (%s), Load: %ld%%, Max: %ld%%, Degraded: %ld, Restored: %ld, Voices stolen: %ld\r\n",
+				cpuGovernor.level, cpuGovernor.LevelName(), cpuGovernor.LoadPercent(cpuGovernor.renderTime), cpuGovernor.LoadPercent(cpuGovernor.maxRenderTime),
+				cpuGovernor.degradeEvents, cpuGovernor.restoreEvents, cpuGovernor.stolenVoices);
 
 	} else if (cmd.compare("resettiming") == 0) {				// Print timing debug info
 		loopTime = 0;
@@ -181,6 +198,10 @@ void CDCHandler::ProcessCommand()
 		for (auto note : voiceManager.noteMapper) {
 			note.drumVoice->debugMaxTime = 0;
 		}
+		cpuGovernor.maxRenderTime = 0;
+		cpuGovernor.degradeEvents = 0;
+		cpuGovernor.restoreEvents = 0;
+		cpuGovernor.stolenVoices = 0;
 		printf("Reset Debug Timings\r\n");
 
 
@@ -225,6 +246,53 @@ void CDCHandler::ProcessCommand()
 			printf("MIDI Channel: %d\r\n", voiceManager.midiChannel);
 		}
 
+	} else if (cmd.compare("polyphony") == 0) {					// Display polyphony of pooled voices
+		printf("Polyphony: Snare: %d, Toms: %d, Claps: %d, Samples: %d\r\n",
+				voiceManager.snarePlayer.allocator.polyphony,
+				voiceManager.tomsPlayer.allocator.polyphony,
+				voiceManager.clapsPlayer.allocator.polyphony,
+				voiceManager.samples.sampler[Samples::playerA].allocator.polyphony);
+
+	} else if (cmd.compare("memory") == 0) {					// Display usage of run time allocation pools
+		printf("RAM_D1: Reverb: %lu, Permanent: %lu, Free: %lu of %lu bytes\r\n",
+				ramD1Arena.TopUsed(), ramD1Arena.BottomUsed(), ramD1Arena.Available(), ramD1Arena.Size());
+		printf("RAM_D2: Reverb: %lu, Permanent: %lu, Free: %lu of %lu bytes\r\n",
+				ramD2Arena.TopUsed(), ramD2Arena.BottomUsed(), ramD2Arena.Available(), ramD2Arena.Size());
+
+	} else if (cmd.compare(0, 10, "snarepoly:") == 0) {			// Set snare polyphony
+		const int32_t voices = ParseInt(cmd, ':', 1, voiceManager.snarePlayer.allocator.maxPolyphony);
+		if (voices > 0) {
+			voiceManager.snarePlayer.allocator.SetPolyphony(voices);
+			configManager.SaveConfig();
+			printf("Snare polyphony: %d\r\n", voiceManager.snarePlayer.allocator.polyphony);
+		}
+
+	} else if (cmd.compare(0, 9, "tomspoly:") == 0) {			// Set toms polyphony
+		const int32_t voices = ParseInt(cmd, ':', 1, voiceManager.tomsPlayer.allocator.maxPolyphony);
+		if (voices > 0) {
+			voiceManager.tomsPlayer.allocator.SetPolyphony(voices);
+			configManager.SaveConfig();
+			printf("Toms polyphony: %d\r\n", voiceManager.tomsPlayer.allocator.polyphony);
+		}
+
+	} else if (cmd.compare(0, 10, "clapspoly:") == 0) {			// Set claps polyphony
+		const int32_t voices = ParseInt(cmd, ':', 1, voiceManager.clapsPlayer.allocator.maxPolyphony);
+		if (voices > 0) {
+			voiceManager.clapsPlayer.allocator.SetPolyphony(voices);
+			configManager.SaveConfig();
+			printf("Claps polyphony: %d\r\n", voiceManager.clapsPlayer.allocator.polyphony);
+		}
+
+	} else if (cmd.compare(0, 11, "samplepoly:") == 0) {		// Set polyphony of both sample players
+		const int32_t voices = ParseInt(cmd, ':', 1, Samples::maxSampleVoices - 1);
+		if (voices > 0) {
+			for (auto& sp : voiceManager.samples.sampler) {
+				sp.allocator.SetPolyphony(voices);
+			}
+			configManager.SaveConfig();
+			printf("Sample polyphony: %d\r\n", voiceManager.samples.sampler[Samples::playerA].allocator.polyphony);
+		}
+
 	} else if (cmd.compare("midimap") == 0) {					// Display MIDI note mapping
 		printf("MIDI mapping: Channel: %d\r\n", voiceManager.midiChannel);
 		for (auto note : voiceManager.noteMapper) {
@@ -250,6 +318,9 @@ void CDCHandler::ProcessCommand()
 			case VoiceManager::claps:
 				printf("Claps   ");
 				break;
+			case VoiceManager::ride:
+				printf("Ride    ");
+				break;
 			}
 			printf(" : %3d, %3d\r\n", note.midiLow, note.midiHigh);
 		}
@@ -16,7 +16,7 @@ void MidiHandler::DataOut()
 	const uint8_t* outBuffBytes = reinterpret_cast<const uint8_t*>(outBuff);
 
 	if (!partialSysEx && outBuffCount == 4) {
-		midiEvent(*outBuff);
+		midiEvent(*outBuff, MidiSource::usb);
 
 	} else if (partialSysEx || (outBuffBytes[1] == 0xF0 && outBuffCount > 3)) {		// Sysex
 		// sysEx will be padded when supplied by usb - add only actual sysEx message bytes to array
@@ -187,6 +187,26 @@ void MidiHandler::ProcessSysex()
 			break;
 		}
 
+		case GetMixerConfig:
+		{
+			// Insert header data
+			const uint8_t cfgHeader = GetMixerConfig;
+
+			uint8_t* cfgBuffer = nullptr;
+			const uint32_t bytes = voiceManager.mixer.SerialiseConfig(&cfgBuffer);
+			const uint32_t len = ConstructSysEx(cfgBuffer, bytes, &cfgHeader, 1, split);
+
+			usb->SendData(sysExOut, len, inEP);
+			break;
+		}
+
+		case SetMixerConfig:
+		{
+			ReadCfgSysEx(1);
+			voiceManager.mixer.StoreConfig(configManager.configBuffer);
+			break;
+		}
+
 		case StartStopSeq:
 			sequencer.StartStop(sysEx[1]);
 			break;
@@ -263,7 +283,7 @@ void MidiHandler::ProcessSysex()
 }
 
 
-void MidiHandler::midiEvent(const uint32_t data)
+void MidiHandler::midiEvent(const uint32_t data, const MidiSource source)
 {
 	auto midiData = MidiData(data);
 	MidiNote midiNote(midiData.db1, midiData.db2);
@@ -275,7 +295,7 @@ void MidiHandler::midiEvent(const uint32_t data)
 			break;
 
 		case NoteOn:
-			voiceManager.NoteOn(midiNote);
+			voiceManager.NoteOn(midiNote, source);
 			break;
 
 		case PitchBend:
@@ -313,7 +333,7 @@ void MidiHandler::serialHandler(uint32_t data)
 			QueueInc();
 		}
 
-		midiEvent(event.data);
+		midiEvent(event.data, MidiSource::serial);
 
 		type = static_cast<MIDIType>(Queue[QueueRead] >> 4);
 		channel = Queue[QueueRead] & 0x0F;
@@ -321,7 +341,7 @@ void MidiHandler::serialHandler(uint32_t data)
 
 	// Clock
 	if (QueueSize > 0 && Queue[QueueRead] == 0xF8) {
-		midiEvent(0xF800);
+		midiEvent(0xF800, MidiSource::serial);
 		QueueInc();
 	}
 
@@ -23,6 +23,8 @@ public:
 	enum MIDIType {Unknown = 0, NoteOn = 0x9, NoteOff = 0x8, PolyPressure = 0xA, ControlChange = 0xB,
 		ProgramChange = 0xC, ChannelPressure = 0xD, PitchBend = 0xE, System = 0xF };
 
+	enum class MidiSource {usb, serial};					// Each source has its own note queue as they are handled in different interrupts
+
 	struct MidiNote {
 		MidiNote(uint8_t n, uint8_t v) : noteValue(n), velocity(v) {};
 
@@ -38,9 +40,10 @@ public:
 
 private:
 	enum sysExCommands {StartStopSeq = 0x1A, GetSequence = 0x1B, SetSequence = 0x1C, GetVoiceConfig = 0x1D, SetVoiceConfig = 0x1E, GetSamples = 0x1F,
-		GetStatus = 0x20, SaveConfig = 0x21, GetReverbConfig = 0x22, SetReverbConfig = 0x23};
+		GetStatus = 0x20, SaveConfig = 0x21, GetReverbConfig = 0x22, SetReverbConfig = 0x23,
+		GetMixerConfig = 0x24, SetMixerConfig = 0x25};
 
-	void midiEvent(const uint32_t data);
+	void midiEvent(const uint32_t data, const MidiSource source);
 	void QueueInc();
 	void ProcessSysex();
 	uint32_t ConstructSysEx(const uint8_t* buffer, uint32_t len, const uint8_t* headerBuffer, const uint32_t headerLen, const bool noSplit);
@@ -13,41 +13,43 @@ public:
 
 	virtual void Play(uint8_t voice, uint32_t noteOffset, uint32_t noteRange, float velocity) = 0;
 	virtual void Play(const uint8_t voice, const uint32_t index) = 0;
-	virtual void CalcOutput() = 0;
+	virtual void CalcOutput() {};														// Legacy single frame output: stores result in outputLevel
+	virtual void Render(float* outL, float* outR, const uint32_t frames) {				// Overwrite buffers with a block of output
+		// Default adapter for voices that only implement the legacy single frame interface
+		for (uint32_t i = 0; i < frames; ++i) {
+			CalcOutput();
+			outL[i] = outputLevel[left];
+			outR[i] = outputLevel[right];
+		}
+	}
+	virtual void Stop() { playing = false; }											// Silence voice immediately (eg when stolen by CPU governor)
 	virtual uint32_t SerialiseConfig(uint8_t** buff, const uint8_t voiceIndex) = 0;		// Return a pointer to config data for saving or transmission over SysEx
 	virtual void StoreConfig(uint8_t* buff, const uint32_t len) = 0;					// Reads config data back into member values
 	virtual uint32_t ConfigSize() = 0;
 	virtual void UpdateFilter() {};
 
-	volatile bool noteQueued;			// Declared volatile to ensure that bool is only set once values are stored ready for playing
-	struct QueuedNote {
-		uint8_t voice;
-		uint32_t noteOffset;
-		uint32_t noteRange;
-		float velocity;
-	} queuedNote;
-
-	// When note is triggered outside main interrupt queue to play in main interrupt
-	void QueuePlay(const uint8_t voice, const uint32_t offset, const uint32_t range, const float velocity) {
-		noteQueued = false;
-		queuedNote.voice = voice;
-		queuedNote.noteOffset = offset;
-		queuedNote.noteRange = range;
-		queuedNote.velocity = velocity;
-		noteQueued = true;
+	constexpr float FreqToInc(const float frequency)
+	{
+		return frequency * (2 * pi) / systemSampleRate;
 	}
 
-	// Called in main interrupt to check if queued note should be played
-	void PlayQueued() {
-		if (noteQueued) {
-			Play(queuedNote.voice, queuedNote.noteOffset, queuedNote.noteRange, queuedNote.velocity);
-			noteQueued = false;
+	// Envelope rates are specified per sample at 48kHz so that configurations sound the same at any sample rate
+	static float DecayRate(const float rate)			// Multiplicative decay applied every sample
+	{
+		if constexpr (systemSampleRate == 48000) {
+			return rate;
+		} else {
+			return std::pow(rate, 1.0f / sampleRateScale);
 		}
 	}
 
-	constexpr float FreqToInc(const float frequency)
+	static float RampRate(const float inc)				// One pole ramp increment: level += inc * (1 - level)
 	{
-		return frequency * (2 * pi) / systemSampleRate;
+		if constexpr (systemSampleRate == 48000) {
+			return inc;
+		} else {
+			return 1.0f - std::pow(1.0f - inc, 1.0f / sampleRateScale);
+		}
 	}
 };
 
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "initialisation.h"
+#include <cmath>
+
+// Multi-segment envelope generator: voices describe their envelopes as a table of segments and the generator renders a block
+// of levels per call. The number of samples in each segment is calculated when the segment starts so rendering has no per
+// sample threshold tests; voices split their block at segment boundaries (see RenderSegment) rather than switching per sample.
+// Slow exponential segments (gain over a block within 1% of unity) covering a full audio block are calculated at block rate with
+// the precomputed gain coeff^blockSize and linearly interpolated across the block, an error of around 1.2e-5 of the distance to
+// the target. Faster segments and shorter runs use the exact per sample recurrence so transients do not depend on block alignment
+
+struct EnvSegment {
+	enum class Curve : uint8_t {exponential, linear};
+	static constexpr float continueLevel = -1.0f;
+	static constexpr uint32_t unending = 0xFFFFFFFF;		// Length of a segment that lasts until the envelope is stopped
+
+	Curve curve = Curve::exponential;
+	float rate = 1.0f;						// Exponential: per sample multiplier of distance from target; linear: per sample increment
+	float target = 0.0f;					// Level approached by an exponential curve
+	float end = 0.0f;						// Segment ends on the sample where the level passes this value
+	uint32_t length = 0;					// If set segment ends after a fixed number of samples instead of at end level
+	float start = continueLevel;			// Level at start of segment (otherwise continues from level at end of previous segment)
+};
+
+
+template<uint32_t maxSegments>
+class Envelope {
+public:
+	EnvSegment segment[maxSegments];		// Filled in by voice before calling Start: values are per sample at the system sample rate
+
+	void Start(const uint32_t segments, const float initLevel = 0.0f)
+	{
+		count = std::min(segments, maxSegments);
+		index = 0;
+		level = initLevel;
+		BeginSegment();
+	}
+
+	void Stop()
+	{
+		index = count;
+	}
+
+	bool Active()		{ return index < count; }
+	uint32_t Segment()	{ return index; }
+	float Level()		{ return level; }
+
+
+	uint32_t RenderSegment(float* out, const uint32_t frames)
+	{
+		// Write levels up to the end of the current segment; returns the number of frames written
+		if (index >= count) {
+			return 0;
+		}
+		const EnvSegment& s = segment[index];
+		const uint32_t n = std::min(frames, remaining);
+		float lvl = level;
+
+		if (s.curve == EnvSegment::Curve::linear) {
+			for (uint32_t i = 0; i < n; ++i) {
+				lvl += s.rate;
+				out[i] = lvl;
+			}
+			if (n == remaining && s.length == 0) {
+				lvl = s.end;						// Linear segments finish exactly at their end level
+				out[n - 1] = lvl;
+			}
+
+		} else if (n == audioBlockSize && blockRamp) {
+			const float endLevel = s.target + (lvl - s.target) * blockGain;
+			const float step = (endLevel - lvl) * (1.0f / audioBlockSize);
+			for (uint32_t i = 0; i < n; ++i) {
+				out[i] = lvl + step * (i + 1);
+			}
+			lvl = endLevel;
+
+		} else {
+			const float target = s.target;
+			const float rate = s.rate;
+			for (uint32_t i = 0; i < n; ++i) {
+				lvl = target + (lvl - target) * rate;
+				out[i] = lvl;
+			}
+		}
+
+		level = lvl;
+		remaining -= n;
+		if (remaining == 0) {
+			++index;
+			BeginSegment();
+		}
+		return n;
+	}
+
+
+	uint32_t Render(float* out, const uint32_t frames)
+	{
+		// Write levels across segment boundaries; returns the number of frames written before the envelope finished
+		uint32_t i = 0;
+		while (i < frames && index < count) {
+			i += RenderSegment(&out[i], frames - i);
+		}
+		return i;
+	}
+
+private:
+	uint32_t count = 0;
+	uint32_t index = 0;
+	uint32_t remaining;						// Samples left in current segment
+	float level = 0.0f;
+	float blockGain;						// Exponential gain over a full audio block
+	bool blockRamp;							// Exponential segment is slow enough to interpolate linearly across a block
+	static constexpr float blockRampTolerance = 0.01f;		// Largest difference of block gain from unity for block rate ramps
+
+	void BeginSegment()
+	{
+		if (index >= count) {
+			return;
+		}
+		const EnvSegment& s = segment[index];
+		if (s.start >= 0.0f) {
+			level = s.start;
+		}
+
+		if (s.length > 0) {
+			remaining = s.length;
+		} else if (s.curve == EnvSegment::Curve::linear) {
+			const float samples = (s.end - level) / s.rate;
+			remaining = SampleCount(samples);
+		} else {
+			// Level after k samples is target + (level - target) * rate^k: solve for the sample where the end level is passed
+			const float ratio = (s.end - s.target) / (level - s.target);
+			remaining = (ratio > 0.0f && s.rate > 0.0f && s.rate < 1.0f) ? SampleCount(std::log(ratio) / std::log(s.rate)) : EnvSegment::unending;
+		}
+
+		if (s.curve == EnvSegment::Curve::exponential) {
+			blockGain = std::pow(s.rate, static_cast<float>(audioBlockSize));
+			blockRamp = std::abs(blockGain - 1.0f) < blockRampTolerance;
+		}
+	}
+
+	static uint32_t SampleCount(const float samples)
+	{
+		// Segments that never reach their end level (including NaN from a zero rate) run until the envelope is stopped
+		if (!(samples < static_cast<float>(EnvSegment::unending))) {
+			return EnvSegment::unending;
+		}
+		return (samples > 1.0f) ? static_cast<uint32_t>(std::ceil(samples)) : 1;
+	}
+};
@@ -1,5 +1,6 @@
 #include <HiHat.h>
 #include "VoiceManager.h"
+#include "NoiseGenerator.h"
 #include <cstring>
 
 
@@ -7,27 +8,29 @@ void HiHat::Play(const uint8_t voice, const uint32_t noteOffset, uint32_t noteRa
 {
 	playing = true;
 
-	velocityScale = velocity * (static_cast<float>(ADC_array[ADC_HiHatLevel]) / 32768.0f);
-	attack = true;
-	attackLevel = 0.0f;
-	noiseScale = intToFloatMult * config.noiseInitLevel;		// noise uses RND peripheral: scale 32 bit value to -1.0 to +1.0
+	const float velocityScale = velocity * (static_cast<float>(controlADC[ADC_HiHatLevel]) / 32768.0f);
 
-	hpFilter.Init();
 	hpFilterCutoff = config.hpInitCutoff;
-
-	lpFilter.Init();
 	lpFilterCutoff = config.lpInitCutoff;
+	SetFilterCutoffs();
+	hpFilter.Init();							// Clears filter state and starts from the initial cutoffs without a ramp
+	lpFilter.Init();
 
 	// Control over decay note index sets initial level; scaled by pot
 	noteRange = noteRange == 0 ? 128 : noteRange;
 	float closed = sqrt((static_cast<float>(noteOffset) + 1.0f) / noteRange);		// store 0.0f - 1.0f to for amount closed
-	closed += (static_cast<float>(ADC_array[ADC_HiHatDecay]) / 65536.0f) - 0.5f;	// pot scales +/-0.5
-	decayScale = std::min(0.9985f + (0.0015f * closed), 0.99998f);
+	closed += (static_cast<float>(controlADC[ADC_HiHatDecay]) / 65536.0f) - 0.5f;	// pot scales +/-0.5
+	const float decayScale = DecayRate(std::min(0.9985f + (0.0015f * closed), 0.99998f));
 
-	for (uint8_t i = 0; i < 6; ++i) {
-		partialPos[i] = 0;
-		partialLevel[i] = config.partialScale[i];
-	}
+	using Curve = EnvSegment::Curve;
+	envelope.segment[Attack] = {Curve::linear, config.attackInc / sampleRateScale, 0.0f, velocityScale};		// Linear attack increment per sample at 48kHz
+	envelope.segment[Decay] = {Curve::exponential, decayScale, 0.0f, 0.001f};								// End when note volume is 0
+	envelope.Start(EnvPhaseCount);
+
+	noiseEnvelope.segment[0] = {Curve::exponential, DecayRate(config.noiseDecay)};
+	noiseEnvelope.Start(1, config.noiseInitLevel);
+
+	partials.Reset();
 }
 
 
@@ -39,86 +42,78 @@ void HiHat::Play(const uint8_t voice, const uint32_t index)
 
 
 
-void HiHat::CalcOutput()
+void HiHat::Render(float* outL, float* outR, const uint32_t frames)
 {
-	if (playing) {
-
-		const int32_t noise = static_cast<int32_t>(RNG->DR);		// Get noise level here to give time for next noise value to be calculated
-
-		float currentLevel[2] = {};				// Store intermediate values of sample level for each channel
+	if (!playing) {
+		std::fill(outL, outL + frames, 0.0f);
+		std::fill(outR, outR + frames, 0.0f);
+		return;
+	}
 
-		for (uint8_t i = 0; i < 6; ++i) {
-			if (config.partialFM[i] > 0 && partialLevel[0] > 0.0f) {			// Add some frequency modulation to some partials
-				partialPos[i] += config.partialFM[i];
-			} else {
-				++partialPos[i];
-			}
+	noiseEnvelope.Render(outR, frames);						// Noise level is rendered into the right buffer and replaced by the output
 
-			if (partialPos[i] > partialPeriod[i]) {
-				partialPos[i] = 0;
-				partialLevel[i] = -partialLevel[i];
-			}
+	float partialOutput[audioBlockSize];
+	partials.Render(partialOutput, frames);
 
-			currentLevel[left] += partialLevel[i];
-		}
+	float rand[2][audioBlockSize];
+	noiseGenerator.Fill(rand[left], frames);
+	noiseGenerator.Fill(rand[right], frames);
 
+	for (uint32_t i = 0; i < frames; ++i) {
+		// Add a burst of noise at the beginning of the note (both channels use the sample partials, but different noise)
+		const float noise = outR[i];
+		outL[i] = partialOutput[i] + noise * rand[left][i];
+		outR[i] = outL[i] + noise * rand[right][i];
+	}
 
-		// Apply an envelope to the HP filter
-		if (hpFilterCutoff < config.hpFinalCutoff) {
-			hpFilterCutoff *= config.hpCutoffInc;
-		}
+	// Apply an envelope to the HP and LP filters: the filters ramp their cutoffs per sample to the end of block values
+	float hpSweep = hpBlockSweep;
+	float lpSweep = lpBlockSweep;
+	if (frames != audioBlockSize) {										// Block split by a note event
+		const float sweepSamples = frames / sampleRateScale;			// Sweep rates are per sample at 48kHz
+		hpSweep = std::pow(config.hpCutoffInc, sweepSamples);
+		lpSweep = std::pow(config.lpCutoffInc, sweepSamples);
+	}
+	hpFilterCutoff = std::min(hpFilterCutoff * hpSweep, config.hpFinalCutoff);
+	lpFilterCutoff = std::max(lpFilterCutoff * lpSweep, config.lpFinalCutoff);
+	SetFilterCutoffs();
+
+	// Filter and apply the attack and decay envelope
+	float envLevel[audioBlockSize];
+	const uint32_t active = envelope.Render(envLevel, frames);
+	hpFilter.Process(outL, outR, active);
+	lpFilter.Process(outL, outR, active);
+	uint32_t i = 0;
+	for (; i < active; ++i) {
+		outL[i] = envLevel[i] * outL[i] - 0.0001f;
+		outR[i] = envLevel[i] * outR[i] - 0.0001f;
+	}
 
-		// Apply an envelope to the LP filter
-		if (lpFilterCutoff > config.lpFinalCutoff) {
-			lpFilterCutoff *= config.lpCutoffInc;
+	for (; i < frames; ++i) {
+		outL[i] = 0.0f;
+		outR[i] = 0.0f;
+	}
 
-		}
+	if (!envelope.Active()) {
+		playing = false;
+	}
 
+	noteMapper->ledLevel = envelope.Level();
+}
 
-		// Add a burst of noise at the beginning of the note (both channels use the sample partials, but different noise)
-		noiseScale *= config.noiseDecay;
-		currentLevel[left] += noiseScale * noise;
-		currentLevel[right] = currentLevel[left] + noiseScale * (int32_t)RNG->DR;
-
-
-		// Apply a short attack fade in then longer decay
-		float envScale;
-		if (attack) {
-			attackLevel += config.attackInc;
-			if (attackLevel >= velocityScale) {
-				attackLevel = velocityScale;
-				attack = false;
-			}
-			envScale = attackLevel;
-		} else {
-			velocityScale *= decayScale;
-			envScale = velocityScale;
-		}
-
-
-		// End when note volume is 0
-		if (velocityScale < 0.001f) {
-			playing = false;
-			currentLevel[left] = 0.0f;
-			currentLevel[right] = 0.0f;
-			hpFilterCutoff = config.hpInitCutoff;			// Reset filter cutoff so initial cofficients can be recalculated in idle time
-			lpFilterCutoff = config.lpInitCutoff;
-		}
-
-		// Filter and scale the output levels
-		outputLevel[0] = envScale * lpFilter.CalcFilter(hpFilter.CalcFilter(currentLevel[left], left), left) - 0.0001f;
-		outputLevel[1] = envScale * lpFilter.CalcFilter(hpFilter.CalcFilter(currentLevel[right], right), right) - 0.0001f;
-
-		noteMapper->pwmLed.Level(velocityScale);
-	}
 
+void HiHat::Stop()
+{
+	playing = false;
+	envelope.Stop();
+	noteMapper->ledLevel = 0.0f;
 }
 
 
-void HiHat::UpdateFilter()
+void HiHat::SetFilterCutoffs()
 {
-	hpFilter.SetCutoff(hpFilterCutoff);
-	lpFilter.SetCutoff(lpFilterCutoff);
+	hpFilter.SetCutoff(hpFilterCutoff / sampleRateScale);
+	lpFilter.SetCutoff(lpFilterCutoff / sampleRateScale);
 }
 
 
@@ -136,9 +131,11 @@ void HiHat::StoreConfig(uint8_t* buff, const uint32_t len)
 	}
 
 	// Apply any settings that are constant until configuration changes
-	for (uint8_t i = 0; i < 6; ++i) {
-		partialPeriod[i] = freqToSqPeriod / config.partialFreq[i];
+	for (uint32_t i = 0; i < partialCount; ++i) {
+		partials.SetPartial(i, config.partialFreq[i], config.partialScale[i], config.partialFM[i]);
 	}
+	hpBlockSweep = std::pow(config.hpCutoffInc, audioBlockSize / sampleRateScale);
+	lpBlockSweep = std::pow(config.lpCutoffInc, audioBlockSize / sampleRateScale);
 }
 
 
@@ -1,16 +1,17 @@
 #pragma once
 #include "initialisation.h"
-#include "Filter.h"
-#include "BPFilter.h"
+#include "SVFilter.h"
 #include "DrumVoice.h"
+#include "Envelope.h"
+#include "SquareBank.h"
 
 class NoteMapper;
-class HiHat  : public DrumVoice {
+class HiHat final : public DrumVoice {
 public:
 	void Play(const uint8_t voice, const uint32_t noteOffset, uint32_t noteRange, const float velocity);
 	void Play(const uint8_t voice, const uint32_t index);
-	void CalcOutput();
-	void UpdateFilter() override;
+	void Render(float* outL, float* outR, const uint32_t frames);
+	void Stop();
 	uint32_t SerialiseConfig(uint8_t** buff, const uint8_t voiceIndex);
 	void StoreConfig(uint8_t* buff, const uint32_t len);
 	uint32_t ConfigSize();
@@ -18,6 +19,8 @@ public:
 	NoteMapper* noteMapper;
 
 private:
+	static constexpr uint32_t partialCount = 6;
+
 	struct Config {
 		float attackInc = 0.005f;			// Attack envelope speed
 		float decay = 0.9991f;				// Decay envelope speed
@@ -34,30 +37,26 @@ private:
 		float noiseDecay = 0.9998f;
 
 		// Relative level and frequency of 6 signal partials
-		float partialScale[6] = {0.8f, 0.5f, 0.4f, 0.4f, 0.5f, 0.4f};
-		float partialFreq[6] = {569.0f, 621.0f, 1559.0f, 2056.0f, 3300.0f, 5515.0f};
+		float partialScale[partialCount] = {0.8f, 0.5f, 0.4f, 0.4f, 0.5f, 0.4f};
+		float partialFreq[partialCount] = {569.0f, 621.0f, 1559.0f, 2056.0f, 3300.0f, 5515.0f};
 
 		// Frequency modulation - amount by which partial 0 frequency modulates other partials
-		uint8_t partialFM[6] = {0, 8, 1, 6, 1, 0};
+		uint8_t partialFM[partialCount] = {0, 8, 1, 6, 1, 0};
 	} config;
 
-	Filter<2> hpFilter{filterPass::HighPass, nullptr};
-	Filter<2> lpFilter{filterPass::LowPass, nullptr};
+	SVFilter<filterPass::HighPass> hpFilter{nullptr};
+	SVFilter<filterPass::LowPass> lpFilter{nullptr};
 
-	float velocityScale;
-	float decayScale;
-	bool attack;							// True during the envelope attack phase
-	float attackLevel;
-	float noiseScale;
+	enum EnvPhase : uint8_t {Attack, Decay, EnvPhaseCount};
+	Envelope<EnvPhaseCount> envelope;		// Short linear attack to velocity level then longer decay
+	Envelope<1> noiseEnvelope;				// Burst of noise at the beginning of the note
 
-	float hpFilterCutoff;
+	float hpFilterCutoff;					// Cutoffs are relative to the Nyquist frequency at 48kHz
 	float lpFilterCutoff;
+	float hpBlockSweep;						// Cutoff sweep multipliers for a full audio block
+	float lpBlockSweep;
+	void SetFilterCutoffs();
 
-	// multiplier to convert frequency to half a period of a square wave
-	static constexpr uint32_t freqToSqPeriod = systemSampleRate / 2;
-
-	float partialLevel[6];					// Output level of each partial
-	uint32_t partialPeriod[6];				// Square wave period
-	uint32_t partialPos[6];					// partial position counter
+	SquareBank<partialCount> partials;		// Band-limited square wave partials
 
 };
@@ -6,13 +6,19 @@
 
 void Kick::Play(const uint8_t voice, const uint32_t noteOffset, const uint32_t noteRange, const float velocity)
 {
+	if (cacheReading) {
+		cache.Release();
+	}
 	playing = true;
-	phase = Phase::Ramp1;
-	position = 0.0f;
-	currentLevel = 0.0f;
-	velocityScale = velocity * (static_cast<float>(ADC_array[ADC_KickLevel]) / 32768.0f);
-	slowSinInc = FreqToInc(config.initSlowSinFreq);
-	slowSinLevel = 1.0f;
+	velocityScale = velocity * (static_cast<float>(controlADC[ADC_KickLevel]) / 32768.0f);
+
+	// Play back from the render cache if it holds the current settings, otherwise synthesise the whole hit
+	const CacheKey key = CurrentKey();
+	cacheReading = cache.Acquire(key);
+	cachePosition = 0;
+	if (!cacheReading) {
+		Start(key);
+	}
 }
 
 
@@ -23,75 +29,150 @@ void Kick::Play(const uint8_t voice, const uint32_t index)
 }
 
 
-void Kick::CalcOutput()
+Kick::CacheKey Kick::CurrentKey()
 {
-	switch (phase) {
-	case Phase::Ramp1:
-		currentLevel = currentLevel + (config.ramp1Inc * (1.0f - currentLevel));
+	return {controlADC[ADC_KickDecay], filter.cutoffFreq, configVersion};
+}
 
-		if (currentLevel > 0.6f) {
-			phase = Phase::Ramp2;
-		}
-		break;
 
-	case Phase::Ramp2:
-		currentLevel = currentLevel + (config.ramp2Inc * (1.0f - currentLevel));
+void Kick::Start(const CacheKey& key)
+{
+	position = SineOsc::Phase(2.0f);
+	slowSinInc = SineOsc::PhaseInc(FreqToInc(config.initSlowSinFreq));
+
+	// Three ramps form the initial click (with a sharp fall after the second); the fast sine is held at full level for 3/4 of
+	// a cycle and the slow sine then decays at a rate set by the decay pot
+	using Curve = EnvSegment::Curve;
+	const float decaySpeed = DecayRate(0.9994f + 0.00055f * static_cast<float>(key.decay) / 65536.0f);
+	EnvSegment* seg = envelope.segment;
+	seg[Ramp1]		= {Curve::exponential, 1.0f - RampRate(config.ramp1Inc), 1.0f, 0.6f};
+	seg[Ramp2]		= {Curve::exponential, 1.0f - RampRate(config.ramp2Inc), 1.0f, 0.82f};
+	seg[Ramp3]		= {Curve::exponential, 1.0f - RampRate(config.ramp3Inc), 1.0f, 0.93f, 0, 0.78f};		// Discontinuity sharply falls at first
+	seg[FastSine]	= {Curve::linear, 0.0f, 0.0f, 1.0f, fastSineLength, 1.0f};
+	seg[SlowSine]	= {Curve::exponential, decaySpeed, 0.0f, 0.00001f};
+	envelope.Start(PhaseCount);
+}
+
 
-		if (currentLevel > 0.82f) {
-			currentLevel = 0.78f;					// discontinuity sharply falls at first
-			phase = Phase::Ramp3;
+uint32_t Kick::Synthesise(float* out, const uint32_t frames)
+{
+	// Writes the filtered hit at unity velocity, returning the number of frames written before the envelope finished.
+	// Voice state is copied to locals so it can be held in registers across the block
+	uint32_t pos = position;
+	float slowInc = slowSinInc;
+	const float fastInc = fastSinInc;
+	const float slowDownRate = DecayRate(config.sineSlowDownRate);
+
+	// Block is split at envelope segment boundaries: ramps output the envelope directly, sine phases use it as their level
+	uint32_t i = 0;
+	while (i < frames && envelope.Active()) {
+		const uint32_t phase = envelope.Segment();
+		const uint32_t count = envelope.RenderSegment(&out[i], frames - i);
+		float* seg = &out[i];
+
+		if (phase == FastSine) {
+			for (uint32_t s = 0; s < count; ++s) {
+				seg[s] *= SineOsc::Next(pos, fastInc);
+			}
+		} else if (phase == SlowSine) {
+			for (uint32_t s = 0; s < count; ++s) {
+				slowInc *= slowDownRate;				// Sine wave slowly decreases in frequency
+				seg[s] *= SineOsc::Next(pos, slowInc);
+			}
 		}
-		break;
+		i += count;
+	}
+	filter.Process(out, i, left);
 
-	case Phase::Ramp3:
-		currentLevel = currentLevel + (config.ramp3Inc * (1.0f - currentLevel));
+	position = pos;
+	slowSinInc = slowInc;
+	return i;
+}
 
-		if (currentLevel > 0.93f) {
-			position = 2.0f;
-			phase = Phase::FastSine;
 
-		}
-		break;
+float Kick::LedLevel()
+{
+	return (envelope.Segment() >= SlowSine) ? envelope.Level() : 1.0f;
+}
+
 
-	case Phase::FastSine:
-		position += fastSinInc;
-		currentLevel = std::sin(position);
+void Kick::Render(float* outL, float* outR, const uint32_t frames)
+{
+	uint32_t active = 0;
+	if (cacheReading) {
+		active = cache.Read(cachePosition, outL, frames, velocityScale);
+		noteMapper->ledLevel = cache.Level(cachePosition);
+
+		if (cache.Finished(cachePosition)) {
+			// Continue with live synthesis from the voice state at the end of the cached buffer
+			const CacheSnapshot& snapshot = cache.State();
+			envelope = snapshot.envelope;
+			position = snapshot.position;
+			slowSinInc = snapshot.slowSinInc;
+			filter.SetState(left, snapshot.filterState);
+			cache.Release();
+			cacheReading = false;
+		}
+	}
 
-		if (position >= 1.5f * pi) {
-			phase = Phase::SlowSine;
+	if (!cacheReading && active < frames) {
+		float* out = &outL[active];
+		const uint32_t count = Synthesise(out, frames - active);
+		const float scale = velocityScale;
+		for (uint32_t i = 0; i < count; ++i) {
+			out[i] *= scale;
 		}
-		break;
-
-	case Phase::SlowSine:
-	{
-		slowSinInc *= config.sineSlowDownRate;			// Sine wave slowly decreases in frequency
-		position += slowSinInc;							// Set current poition in sine wave
-		const float decaySpeed = 0.9994f + 0.00055f * static_cast<float>(ADC_array[ADC_KickDecay]) / 65536.0f;
-		slowSinLevel = slowSinLevel * decaySpeed;
-		currentLevel = std::sin(position) * slowSinLevel;
-
-		if (slowSinLevel <= 0.00001f) {
-			playing = false;
-			phase = Phase::Off;
+		if (count > 0) {
+			noteMapper->ledLevel = LedLevel();
 		}
-		break;
+		active += count;
 	}
 
-	default:
-		break;
+	// Copy the active part of the block to the right channel; silence the remainder once the note has ended
+	uint32_t i = 0;
+	for (; i < active; ++i) {
+		outR[i] = outL[i];
+	}
+	for (; i < frames; ++i) {
+		outL[i] = 0.0f;
+		outR[i] = 0.0f;
 	}
 
-	if (phase != Phase::Off) {
-		noteMapper->pwmLed.Level(slowSinLevel);
-		outputLevel[0] = velocityScale * filter.CalcFilter(currentLevel, left);
-		outputLevel[1] = outputLevel[0];
+	playing = cacheReading || envelope.Active();
+}
+
+
+void Kick::Stop()
+{
+	if (cacheReading) {
+		cache.Release();
+		cacheReading = false;
 	}
+	playing = false;
+	envelope.Stop();
+	noteMapper->ledLevel = 0.0f;
 }
 
 
 void Kick::UpdateFilter()
 {
 	filter.Update(false);
+
+	// Re-render the cached hit once the decay pot, filter and configuration have settled
+	const CacheKey key = CurrentKey();
+	cache.Update(key, [&](float* buffer, const uint32_t capacity, float* blockLevel, CacheSnapshot& snapshot) {
+		Kick renderer = *this;
+		renderer.Start(key);
+		renderer.filter.Init();
+
+		uint32_t length = 0;
+		for (uint32_t block = 0; length < capacity && renderer.envelope.Active(); ++block) {
+			length += renderer.Synthesise(&buffer[length], std::min(audioBlockSize, capacity - length));
+			blockLevel[block] = renderer.LedLevel();
+		}
+		snapshot = {renderer.envelope, renderer.position, renderer.slowSinInc, renderer.filter.GetState(left)};
+		return length;
+	});
 }
 
 
@@ -109,7 +190,9 @@ void Kick::StoreConfig(uint8_t* buff, const uint32_t len)
 	}
 
 	// Apply any settings that are constant until configuration changes
-	fastSinInc = FreqToInc(config.fastSinFreq);
+	fastSinInc = SineOsc::PhaseInc(FreqToInc(config.fastSinFreq));
+	fastSineLength = static_cast<uint32_t>(std::ceil((1.5f * pi - 2.0f) / FreqToInc(config.fastSinFreq)));
+	++configVersion;
 }
 
 uint32_t Kick::ConfigSize()
@@ -1,15 +1,19 @@
 #pragma once
 #include "initialisation.h"
-#include "Filter.h"
+#include "SVFilter.h"
 #include "DrumVoice.h"
+#include "SineOsc.h"
+#include "Envelope.h"
+#include "RenderCache.h"
 
 class NoteMapper;
 
-class Kick : public DrumVoice {
+class Kick final : public DrumVoice {
 public:
 	void Play(const uint8_t voice, const uint32_t noteOffset, const uint32_t noteRange, const float velocity);
 	void Play(const uint8_t voice, const uint32_t index);
-	void CalcOutput();
+	void Render(float* outL, float* outR, const uint32_t frames);
+	void Stop();
 	void UpdateFilter();
 	uint32_t SerialiseConfig(uint8_t** buff, const uint8_t voiceIndex);
 	void StoreConfig(uint8_t* buff, const uint32_t len);
@@ -17,17 +21,46 @@ public:
 
 	NoteMapper* noteMapper;
 
+	// Start of each hit is pre-rendered while decay, filter and configuration are unchanged: up to 256ms at 48kHz (32ms at
+	// 96kHz) from the RAM_D2 pool shared with the reverb diffusers (see main.cpp)
+	static constexpr uint32_t cacheSize = (systemSampleRate == 48000) ? 12288 : 3072;
+	static bool InvalidateCache()	{ return cache.Invalidate(); }
+	static void FreeCache()			{ cache.FreeBuffer(); }
+
 private:
-	enum class Phase {Off, Ramp1, Ramp2, Ramp3, FastSine, SlowSine} phase;
-	Filter<2> filter{filterPass::LowPass, &(ADC_array[ADC_KickAttack])};
+	enum Phase : uint8_t {Ramp1, Ramp2, Ramp3, FastSine, SlowSine, PhaseCount};		// Envelope segment of each phase
+	Envelope<PhaseCount> envelope;
+	SVFilter<filterPass::LowPass> filter{&(ADC_array[ADC_KickAttack])};
 
-	float position;
-	float currentLevel;
+	uint32_t position;
 	float velocityScale;
+	uint32_t configVersion = 0;					// Incremented on each configuration change to invalidate the render cache
+
+	struct CacheKey {
+		static constexpr int32_t decayHysteresis = 64;
+		uint16_t decay;							// Decay pot ADC reading
+		float cutoff;
+		uint32_t configVersion;
+
+		bool Matches(const CacheKey& k) const {
+			return cutoff == k.cutoff && configVersion == k.configVersion && std::abs(decay - k.decay) < decayHysteresis;
+		}
+	};
+
+	struct CacheSnapshot {						// Synthesis state at the end of the cached buffer
+		Envelope<PhaseCount> envelope;
+		uint32_t position;
+		float slowSinInc;
+		SVFilter<filterPass::LowPass>::State filterState;
+	};
+
+	static inline RenderCache<CacheKey, CacheSnapshot, cacheSize> cache{ramD2Arena};
+	uint32_t cachePosition;
+	bool cacheReading = false;					// Note is playing back from the render cache
 
-	float slowSinInc;
-	float slowSinLevel;
-	float fastSinInc = FreqToInc(config.fastSinFreq);
+	float slowSinInc;							// Sine increments are in SineOsc phase units
+	float fastSinInc;
+	uint32_t fastSineLength;					// Samples for the fast sine to run from 2 radians to 3/4 of a cycle
 
 	struct Config {
 		float ramp1Inc = 0.22f;					// Initial steep ramp
@@ -38,5 +71,9 @@ private:
 		float sineSlowDownRate = 0.999985f;		// Rate at which slow sine wave frequency decreases
 	} config;
 
+	CacheKey CurrentKey();
+	void Start(const CacheKey& key);
+	uint32_t Synthesise(float* out, const uint32_t frames);
+	float LedLevel();
 };
 
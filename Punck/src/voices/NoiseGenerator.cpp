@@ -0,0 +1,15 @@
+#include "NoiseGenerator.h"
+
+NoiseGenerator noiseGenerator;
+
+void NoiseGenerator::Seed()
+{
+	while ((RNG->SR & RNG_SR_DRDY) == 0) {}			// Wait for hardware RNG to calculate first value
+	Seed(RNG->DR);
+}
+
+
+void NoiseGenerator::Seed(const uint32_t seed)
+{
+	state = (seed != 0) ? seed : defaultSeed;
+}
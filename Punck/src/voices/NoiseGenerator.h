@@ -0,0 +1,44 @@
+#pragma once
+
+#include "initialisation.h"
+
+// Software white noise shared by all noise based voices: a 32 bit xorshift generator filling blocks of float noise in the range
+// -1.0 to 1.0. Avoids reading the hardware RNG every sample (the peripheral needs time to calculate each value so back to back
+// reads stall or repeat). Seeded once from the hardware RNG; a fixed seed gives repeatable output for regression testing
+
+class NoiseGenerator {
+public:
+	void Seed();									// Seed from hardware random number generator
+	void Seed(const uint32_t seed);
+
+	uint32_t NextInt()
+	{
+		uint32_t x = state;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		state = x;
+		return x;
+	}
+
+	void Fill(float* out, const uint32_t frames, const float scale = 1.0f)
+	{
+		// Each call continues the sequence so filling left then right channel buffers gives decorrelated stereo noise
+		uint32_t x = state;
+		const float mult = scale * intToFloatMult;
+		for (uint32_t i = 0; i < frames; ++i) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			out[i] = mult * static_cast<int32_t>(x);
+		}
+		state = x;
+	}
+
+	static constexpr uint32_t defaultSeed = 0x9E3779B9;
+
+private:
+	uint32_t state = defaultSeed;					// Generator state must never be zero
+};
+
+extern NoiseGenerator noiseGenerator;
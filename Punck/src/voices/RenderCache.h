@@ -0,0 +1,126 @@
+#pragma once
+
+#include "initialisation.h"
+#include "MemoryArena.h"
+
+// Pre-rendered start of a deterministic voice hit. When the voice's parameters (Key) have been stable for a short time the
+// idle loop renders the unscaled hit into a buffer, along with a snapshot of the voice's synthesis state at the end of the
+// buffer. Notes started with matching parameters play back from the buffer with a velocity multiply and then continue live
+// synthesis from the snapshot. Any parameter change invalidates the cache so notes fall back to live synthesis until the idle
+// loop has re-rendered it. The buffer is never rewritten while a note is reading from it.
+// The buffer is allocated from the bottom of a memory arena before the first render, after the reverb has taken the space for its
+// stored configuration: if the arena cannot hold the full capacity a shorter start of the hit is cached. If the reverb later needs
+// more space the buffer is given back (see VoiceManager::IdleTasks) and allocated again from what is left.
+// Key must provide bool Matches(const Key&) (which may allow for ADC jitter)
+
+template<typename Key, typename Snapshot, uint32_t capacity>
+class RenderCache {
+public:
+	static constexpr uint32_t stableTicks = 50;				// Parameters must be unchanged for 50ms before rendering
+
+	RenderCache(MemoryArena& arena) : arena{arena} {}
+
+	// Audio interrupt: Acquire is called when a note starts and returns true if the note can play from the cache
+	bool Acquire(const Key& key)
+	{
+		if (valid && cachedKey.Matches(key)) {
+			++readers;
+			return true;
+		}
+		return false;
+	}
+
+
+	void Release()
+	{
+		--readers;
+	}
+
+
+	uint32_t Read(uint32_t& pos, float* out, const uint32_t frames, const float scale)
+	{
+		// Write scaled cached samples from pos, returning the number of frames written (less than frames at end of cache)
+		const uint32_t count = std::min(frames, length - pos);
+		const float* in = &buffer[pos];
+		for (uint32_t i = 0; i < count; ++i) {
+			out[i] = in[i] * scale;
+		}
+		pos += count;
+		return count;
+	}
+
+
+	// Idle loop: stop new notes reading the cache, returning true if no note is still reading it so its memory can be released
+	bool Invalidate()
+	{
+		releasing = true;					// Not rendered again until the buffer has been freed
+		valid = false;
+		__DMB();							// Audio interrupt must see the cache invalid before readers is checked
+		return readers == 0;
+	}
+
+
+	void FreeBuffer()						// Idle loop: arena memory has been released; a new buffer is allocated before the next render
+	{
+		buffer = nullptr;
+		size = 0;
+		releasing = false;
+	}
+
+
+	bool Finished(const uint32_t pos)		{ return pos >= length; }
+	float Level(const uint32_t pos)			{ return blockLevel[(pos - 1) / audioBlockSize]; }		// Envelope level for LED
+	const Snapshot& State()					{ return snapshot; }
+
+
+	// Idle loop: render must write up to capacity samples, the envelope level of each block and the snapshot, returning the
+	// number of samples written
+	template<typename RenderFn>
+	void Update(const Key& key, RenderFn render)
+	{
+		if ((valid && cachedKey.Matches(key)) || releasing) {
+			return;
+		}
+		valid = false;
+
+		if (!pendingKey.Matches(key)) {
+			pendingKey = key;
+			pendingTime = SysTickVal;
+			return;
+		}
+		if (readers > 0 || SysTickVal - pendingTime < stableTicks) {
+			return;
+		}
+
+		if (buffer == nullptr) {
+			size = std::min(capacity, arena.Fits<float>()) / audioBlockSize * audioBlockSize;	// Whole blocks up to capacity
+			if (size == 0) {
+				return;
+			}
+			buffer = arena.Allocate<float>(size);
+			if (buffer == nullptr) {
+				size = 0;
+				return;
+			}
+		}
+
+		cachedKey = key;
+		length = render(buffer, size, blockLevel, snapshot);
+		valid = (length > 0);
+	}
+
+private:
+	MemoryArena& arena;
+	float* buffer = nullptr;
+	uint32_t size = 0;						// Samples allocated: capacity unless the arena was short of space
+	uint32_t length = 0;
+	float blockLevel[(capacity + audioBlockSize - 1) / audioBlockSize];
+	Snapshot snapshot;
+
+	Key cachedKey;
+	Key pendingKey;
+	uint32_t pendingTime = 0;
+	bool releasing = false;					// Buffer is to be given back to the arena once no note is reading it
+	volatile bool valid = false;
+	volatile uint32_t readers = 0;			// Notes currently playing from the buffer
+};
@@ -0,0 +1,120 @@
+#include "Ride.h"
+#include "VoiceManager.h"
+#include "NoiseGenerator.h"
+#include <cstring>
+
+
+void Ride::Play(const uint8_t voice, const uint32_t noteOffset, uint32_t noteRange, const float velocity)
+{
+	playing = true;
+
+	// Note index opens the low pass filter from the bow setting to fully open for the bell
+	noteRange = noteRange == 0 ? 128 : noteRange;
+	const float bell = std::min((static_cast<float>(noteOffset) + 1.0f) / noteRange, 1.0f);
+	constexpr float lpMaxCutoff = 0.9f;
+	lpFilterCutoff = config.lpInitCutoff + bell * (lpMaxCutoff - config.lpInitCutoff);
+
+	hpFilter.SetCutoff(config.hpCutoff / sampleRateScale);
+	lpFilter.SetCutoff(lpFilterCutoff / sampleRateScale);
+	hpFilter.Init();
+	lpFilter.Init();
+
+	using Curve = EnvSegment::Curve;
+	const float level = velocity * config.level;
+	envelope.segment[Attack] = {Curve::linear, config.attackInc / sampleRateScale, 0.0f, level};		// Linear attack increment per sample at 48kHz
+	envelope.segment[Decay] = {Curve::exponential, DecayRate(config.decay), 0.0f, 0.0001f * level};
+	envelope.Start(EnvPhaseCount);
+
+	noiseEnvelope.segment[0] = {Curve::exponential, DecayRate(config.noiseDecay)};
+	noiseEnvelope.Start(1, config.noiseInitLevel);
+
+	partials.Reset();
+}
+
+
+void Ride::Play(const uint8_t voice, const uint32_t index)
+{
+	Play(0, index, 0, 1.0f);
+}
+
+
+void Ride::Render(float* outL, float* outR, const uint32_t frames)
+{
+	if (!playing) {
+		std::fill(outL, outL + frames, 0.0f);
+		std::fill(outR, outR + frames, 0.0f);
+		return;
+	}
+
+	noiseEnvelope.Render(outR, frames);						// Noise level is rendered into the right buffer and replaced by the output
+
+	float partialOutput[audioBlockSize];
+	partials.Render(partialOutput, frames);
+
+	float rand[2][audioBlockSize];
+	noiseGenerator.Fill(rand[left], frames);
+	noiseGenerator.Fill(rand[right], frames);
+
+	for (uint32_t i = 0; i < frames; ++i) {
+		const float noise = outR[i];
+		outL[i] = partialOutput[i] + noise * rand[left][i];
+		outR[i] = partialOutput[i] + noise * rand[right][i];
+	}
+
+	// Low pass filter closes as the note decays: the filter ramps its cutoff per sample to the end of block value
+	const float lpSweep = (frames == audioBlockSize) ? lpBlockSweep : std::pow(config.lpCutoffInc, frames / sampleRateScale);
+	lpFilterCutoff = std::max(lpFilterCutoff * lpSweep, config.lpFinalCutoff);
+	lpFilter.SetCutoff(lpFilterCutoff / sampleRateScale);
+
+	float envLevel[audioBlockSize];
+	const uint32_t active = envelope.Render(envLevel, frames);
+	hpFilter.Process(outL, outR, active);
+	lpFilter.Process(outL, outR, active);
+	uint32_t i = 0;
+	for (; i < active; ++i) {
+		outL[i] *= envLevel[i];
+		outR[i] *= envLevel[i];
+	}
+	for (; i < frames; ++i) {
+		outL[i] = 0.0f;
+		outR[i] = 0.0f;
+	}
+
+	playing = envelope.Active();
+	noteMapper->ledLevel = envelope.Level();
+}
+
+
+void Ride::Stop()
+{
+	playing = false;
+	envelope.Stop();
+	noteMapper->ledLevel = 0.0f;
+}
+
+
+uint32_t Ride::SerialiseConfig(uint8_t** buff, const uint8_t voiceIndex)
+{
+	*buff = reinterpret_cast<uint8_t*>(&config);
+	return sizeof(config);
+}
+
+
+void Ride::StoreConfig(uint8_t* buff, const uint32_t len)
+{
+	if (buff != nullptr && len <= sizeof(config)) {
+		memcpy(&config, buff, len);
+	}
+
+	// Apply any settings that are constant until configuration changes
+	for (uint32_t i = 0; i < partialCount; ++i) {
+		partials.SetPartial(i, config.baseFreq * config.partialRatio[i], config.partialLevel[i], config.partialFM[i], config.partialFMSource[i]);
+	}
+	lpBlockSweep = std::pow(config.lpCutoffInc, audioBlockSize / sampleRateScale);
+}
+
+
+uint32_t Ride::ConfigSize()
+{
+	return sizeof(config);
+}
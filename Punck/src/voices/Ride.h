@@ -0,0 +1,61 @@
+#pragma once
+#include "initialisation.h"
+#include "SVFilter.h"
+#include "DrumVoice.h"
+#include "Envelope.h"
+#include "SquareBank.h"
+
+// Ride cymbal built from a bank of inharmonic square partials with frequency modulation, a fixed high pass filter and a low pass
+// filter that closes as the note decays. Note index sets brightness: low notes play the bow of the cymbal, high notes the bell
+// Render cost is about 1.7 times the hi-hat's in a host build; it has not yet been profiled against the hi-hat with TIMINGDEBUG
+
+class NoteMapper;
+class Ride final : public DrumVoice {
+public:
+	void Play(const uint8_t voice, const uint32_t noteOffset, uint32_t noteRange, const float velocity);
+	void Play(const uint8_t voice, const uint32_t index);
+	void Render(float* outL, float* outR, const uint32_t frames);
+	void Stop();
+	uint32_t SerialiseConfig(uint8_t** buff, const uint8_t voiceIndex);
+	void StoreConfig(uint8_t* buff, const uint32_t len);
+	uint32_t ConfigSize();
+
+	NoteMapper* noteMapper;
+
+private:
+	static constexpr uint32_t partialCount = 12;
+
+	struct Config {
+		float attackInc = 0.02f;			// Attack envelope speed
+		float decay = 0.99997f;				// Decay envelope speed (approx 4.8 seconds to -60dB)
+		float level = 0.25f;
+
+		float baseFreq = 340.0f;			// Partial frequencies are ratios of the base frequency
+		float hpCutoff = 0.1f;				// HP filter fixed at 2.4kHz
+		float lpInitCutoff = 0.6f;			// LP filter closes from 14.4kHz to 6kHz (bell notes start fully open)
+		float lpFinalCutoff = 0.25f;
+		float lpCutoffInc = 0.99997f;
+
+		float noiseInitLevel = 0.3f;		// Stick noise at the start of the note
+		float noiseDecay = 0.9994f;
+
+		float partialLevel[partialCount] = {0.5f, 0.45f, 0.4f, 0.4f, 0.35f, 0.35f, 0.3f, 0.3f, 0.25f, 0.25f, 0.2f, 0.2f};
+		float partialRatio[partialCount] = {1.0f, 1.4717f, 1.6170f, 1.9265f, 2.5028f, 2.6637f, 3.1596f, 3.7624f, 4.2321f, 5.4070f, 6.8300f, 8.1163f};
+
+		// Frequency modulation: partial frequency is multiplied by partialFM while its source partial is high (0 or 1 for none)
+		uint8_t partialFM[partialCount] = {0, 3, 0, 2, 0, 3, 0, 2, 0, 0, 2, 0};
+		uint8_t partialFMSource[partialCount] = {0, 0, 0, 2, 0, 1, 0, 4, 0, 0, 6, 0};
+	} config;
+
+	SVFilter<filterPass::HighPass> hpFilter{nullptr};
+	SVFilter<filterPass::LowPass> lpFilter{nullptr};
+
+	enum EnvPhase : uint8_t {Attack, Decay, EnvPhaseCount};
+	Envelope<EnvPhaseCount> envelope;		// Short linear attack to velocity level then long decay
+	Envelope<1> noiseEnvelope;
+
+	float lpFilterCutoff;					// Cutoff is relative to the Nyquist frequency at 48kHz
+	float lpBlockSweep;						// Cutoff sweep multiplier for a full audio block
+
+	SquareBank<partialCount, false> partials;	// Naive squares: the bank is large and aliasing is masked by the inharmonic spectrum
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "initialisation.h"
+#include <cmath>
+
+// Phase accumulator sine oscillator shared by the drum voices. Phase is held as a 32 bit fraction of a cycle so it wraps without
+// losing precision however long a note sounds; output is read from a 1024 point table with linear interpolation.
+// Maximum error against std::sin over a full cycle is 4.8e-6 (-106dB), below the resolution of the 24 bit codec path: 4.7e-6 from
+// interpolation plus float rounding. Checked on the host by test/SineOscTest.cpp
+
+class SineOsc {
+public:
+	static constexpr uint32_t tableBits = 10;
+	static constexpr uint32_t tableSize = 1 << tableBits;
+	static constexpr uint32_t fractionBits = 32 - tableBits;
+	static constexpr float phaseScale = 4294967296.0 / (2.0 * pi);				// Phase units per radian
+
+	static constexpr uint32_t Phase(const float radians)						// Convert an absolute position in radians to a phase
+	{
+		return static_cast<uint32_t>(static_cast<int64_t>(radians * phaseScale));
+	}
+
+	static constexpr float PhaseInc(const float radians)						// Convert a per sample increment in radians to phase units
+	{
+		return radians * phaseScale;
+	}
+
+	static float Sine(const uint32_t phase)
+	{
+		const uint32_t index = phase >> fractionBits;
+		const float fraction = static_cast<float>(phase & ((1 << fractionBits) - 1)) * (1.0f / (1 << fractionBits));
+		return table.value[index] + fraction * (table.value[index + 1] - table.value[index]);
+	}
+
+	static float Next(uint32_t& phase, const float inc)						// Advance phase by increment (in phase units) and return sine
+	{
+		phase += static_cast<uint32_t>(inc);
+		return Sine(phase);
+	}
+
+private:
+	struct Table {
+		float value[tableSize + 1];												// Extra point so interpolation does not need to wrap
+
+		Table()
+		{
+			for (uint32_t i = 0; i <= tableSize; ++i) {
+				value[i] = static_cast<float>(std::sin(2.0 * pi * i / tableSize));
+			}
+		}
+	};
+	// Built at startup: .bss is placed in DTCM by the linker script so the table is read without wait states or cache misses
+	static inline Table table __attribute__((section(".bss.SineOscTable")));
+};
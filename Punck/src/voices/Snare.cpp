@@ -1,25 +1,29 @@
 #include "Snare.h"
 #include "VoiceManager.h"
+#include "NoiseGenerator.h"
 
 void Snare::Play(const uint8_t voice, const uint32_t noteOffset, uint32_t noteRange, const float velocity)
 {
 	playing = true;
 
-	partialpos[0] = config.basePos;						// Create discontinuity to create initial click
-	partialpos[1] = 0.0f;
-	partialpos[2] = 0.0f;
+	partialpos[0] = SineOsc::Phase(config.basePos);		// Create discontinuity to create initial click
+	partialpos[1] = 0;
+	partialpos[2] = 0;
 
-	const float freq = (config.baseFreq * (static_cast<float>(ADC_array[ADC_SnareTuning]) / 65536.0f + 0.5f));
+	const float freq = (config.baseFreq * (static_cast<float>(controlADC[ADC_SnareTuning]) / 65536.0f + 0.5f));
 
 	for (uint8_t i = 0; i < partialCount; ++i) {
-		partialLevel[i] = config.partialInitLevel[i];
-		partialInc[i] = FreqToInc(freq * config.partialFreqOffset[i]);
+		partialInc[i] = SineOsc::PhaseInc(FreqToInc(freq * config.partialFreqOffset[i]));
 	}
-	noiseLevel = config.noiseInitLevel;
-	velocityScale = velocity * (static_cast<float>(ADC_array[ADC_SnareLevel]) / 32768.0f);
+	velocityScale = velocity * (static_cast<float>(controlADC[ADC_SnareLevel]) / 32768.0f);
 
 	noteRange = noteRange == 0 ? 128 : noteRange;
 	sustainRate = 0.0012f * sqrt((static_cast<float>(noteOffset) + 1.0f) / noteRange);		// note offset allows for longer sustained hits
+
+	partialEnvelope.segment[0] = {EnvSegment::Curve::exponential, DecayRate(config.partialDecay + sustainRate)};
+	partialEnvelope.Start(1, 1.0f);
+	noiseEnvelope.segment[0] = {EnvSegment::Curve::exponential, DecayRate(config.noiseDecay + sustainRate)};
+	noiseEnvelope.Start(1, config.noiseInitLevel);
 }
 
 
@@ -30,37 +34,63 @@ void Snare::Play(const uint8_t voice, const uint32_t index)
 }
 
 
-void Snare::CalcOutput()
+void Snare::Render(float* outL, float* outR, const uint32_t frames)
 {
-	if (playing) {
-		const float rand1 = intToFloatMult * static_cast<int32_t>(RNG->DR);		// Left channel random number used for noise
+	if (!playing) {
+		std::fill(outL, outL + frames, 0.0f);
+		std::fill(outR, outR + frames, 0.0f);
+		return;
+	}
+
+	// Voice state is copied to locals so it can be held in registers across the block
+	uint32_t pos[partialCount];
+	float inc[partialCount];
+	float initLevel[partialCount];
+	for (uint8_t p = 0; p < partialCount; ++p) {
+		pos[p] = partialpos[p];
+		inc[p] = partialInc[p];
+		initLevel[p] = config.partialInitLevel[p];
+	}
+
+	// Envelope levels are rendered into the output buffers and then replaced by the output: left holds partial level, right noise
+	partialEnvelope.Render(outL, frames);
+	noiseEnvelope.Render(outR, frames);
 
-		noiseLevel *= config.noiseDecay + sustainRate;
-		float maxLevel = noiseLevel;
+	float rand[2][audioBlockSize];								// Separate noise for each channel
+	noiseGenerator.Fill(rand[left], frames);
+	noiseGenerator.Fill(rand[right], frames);
 
+	for (uint32_t i = 0; i < frames; ++i) {
+		const float noise = outR[i];
 		float partialOutput = 0.0f;
-		for (uint8_t i = 0; i < partialCount; ++i) {
-			partialpos[i] += partialInc[i];							// Set current poition in sine wave
-			partialLevel[i] *= config.partialDecay + sustainRate;
-			partialOutput += std::sin(partialpos[i]) * partialLevel[i];
-
-			if (partialLevel[i] > maxLevel) {
-				maxLevel = partialLevel[i];
-			}
+		for (uint8_t p = 0; p < partialCount; ++p) {
+			partialOutput += SineOsc::Next(pos[p], inc[p]) * initLevel[p];
 		}
+		partialOutput *= outL[i];
 
-		const float rand2 = intToFloatMult * static_cast<int32_t>(RNG->DR);		// Get right channel noise value: calc here to give time for peripheral to update
+		outL[i] = partialOutput + (rand[left][i] * noise);
+		outR[i] = partialOutput + (rand[right][i] * noise);
+	}
 
-		outputLevel[left]  = velocityScale * filter.CalcFilter(partialOutput + (rand1 * noiseLevel), left);
-		outputLevel[right] = velocityScale * filter.CalcFilter(partialOutput + (rand2 * noiseLevel), right);
+	const float scale = velocityScale;
+	filter.Process(outL, outR, frames);
+	for (uint32_t i = 0; i < frames; ++i) {
+		outL[i] *= scale;
+		outR[i] *= scale;
+	}
 
-		if (maxLevel < 0.00001f) {
-			playing = false;
-		}
+	// Levels only decay so the end of block values determine when the note has finished
+	float maxLevel = noiseEnvelope.Level();
+	for (uint8_t p = 0; p < partialCount; ++p) {
+		partialpos[p] = pos[p];
+		maxLevel = std::max(maxLevel, initLevel[p] * partialEnvelope.Level());
+	}
 
-		noteMapper->pwmLed.Level(maxLevel);
+	if (maxLevel < 0.00001f) {
+		playing = false;
 	}
 
+	noteMapper->ledLevel = maxLevel;
 }
 
 
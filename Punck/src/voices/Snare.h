@@ -1,17 +1,19 @@
 #pragma once
 #include "initialisation.h"
 #include "DrumVoice.h"
-#include "Filter.h"
+#include "SVFilter.h"
+#include "SineOsc.h"
+#include "Envelope.h"
 
 class NoteMapper;
 
 
 
-class Snare : public DrumVoice {
+class Snare final : public DrumVoice {
 public:
 	void Play(const uint8_t voice, const uint32_t noteOffset, uint32_t noteRange, const float velocity);
 	void Play(const uint8_t voice, const uint32_t index);
-	void CalcOutput();
+	void Render(float* outL, float* outR, const uint32_t frames);
 	void UpdateFilter();
 	uint32_t SerialiseConfig(uint8_t** buff, const uint8_t voiceIndex);
 	void StoreConfig(uint8_t* buff, const uint32_t len);
@@ -20,11 +22,11 @@ public:
 	NoteMapper* noteMapper;
 private:
 	static constexpr uint8_t partialCount = 3;
-	float partialLevel[partialCount];
-	float partialpos[partialCount];
-	float partialInc[partialCount];
+	uint32_t partialpos[partialCount];
+	float partialInc[partialCount];						// In SineOsc phase units
 
-	float noiseLevel;
+	Envelope<1> partialEnvelope;						// All partials decay at the same rate from their initial levels
+	Envelope<1> noiseEnvelope;
 	float velocityScale;
 	float sustainRate;
 
@@ -41,6 +43,6 @@ private:
 	} config;
 
 
-	Filter<2> filter{filterPass::LowPass, &(ADC_array[ADC_SnareFilter])};		// Filters combined partial and noise elements of sound
+	SVFilter<filterPass::LowPass> filter{&(ADC_array[ADC_SnareFilter])};	// Filters combined partial and noise elements of sound
 };
 
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "initialisation.h"
+#include <cmath>
+
+// Bank of square wave partials for metallic voices (hi-hat, ride). Each partial has a 32 bit phase accumulator so frequencies
+// are not truncated to a whole number of samples. If bandLimited is set the rising edge (phase 0) and falling edge (half phase)
+// are corrected with a two sample PolyBLEP; large banks can omit this to process roughly three times as many partials for the
+// same cost. Each partial can be frequency modulated by another partial in the bank: while the source partial's output is high
+// the partial advances by its FM increment instead of its normal increment. The per sample update contains no branches so the
+// partial loop can be vectorised or paired by the compiler
+
+template<uint32_t partials, bool bandLimited = true>
+class SquareBank {
+public:
+	// Phase units per Hz: normal and FM increments are both derived from Hz so the FM step scales with the sample rate
+	static constexpr float phaseScale = 4294967296.0f / (48000.0f * sampleRateScale);
+
+	void SetPartial(const uint32_t p, const float freq, const float level, const float fmMultiplier = 1.0f, const uint32_t fmSource = 0)
+	{
+		// fmMultiplier scales the partial's frequency while the source partial is high (0 or 1 for no modulation)
+		const float fm = std::max(fmMultiplier, 1.0f);
+		inc[p] = static_cast<uint32_t>(std::min(freq, nyquist) * phaseScale);
+		fmInc[p] = static_cast<uint32_t>(std::min(freq * fm, nyquist) * phaseScale);
+		invInc[p] = 1.0f / std::max<uint32_t>(inc[p], 1);
+		invFmInc[p] = 1.0f / std::max<uint32_t>(fmInc[p], 1);
+		source[p] = std::min(fmSource, partials - 1);
+		this->level[p] = level;
+	}
+
+
+	void Reset()
+	{
+		for (uint32_t p = 0; p < partials; ++p) {
+			phase[p] = 0;
+		}
+	}
+
+
+	void Render(float* out, const uint32_t frames)			// Write the sum of all partials
+	{
+		for (uint32_t i = 0; i < frames; ++i) {
+			uint32_t highMask[partials];						// All bits set while each partial is in its high half cycle
+			for (uint32_t p = 0; p < partials; ++p) {
+				highMask[p] = (phase[p] >> 31) - 1;
+			}
+
+			float value[partials];
+			for (uint32_t p = 0; p < partials; ++p) {
+				const uint32_t fmMask = highMask[source[p]];
+				const uint32_t step = (fmInc[p] & fmMask) | (inc[p] & ~fmMask);
+				const uint32_t ph = phase[p] + step;
+				phase[p] = ph;
+
+				const float naive = 1.0f - 2.0f * static_cast<float>(static_cast<int32_t>(ph >> 31));
+				if constexpr (bandLimited) {
+					// Distance from each edge in samples (signed phase difference wraps into -0.5 to 0.5 of a cycle)
+					const float fmGate = static_cast<float>(static_cast<int32_t>(fmMask & 1));
+					const float invStep = invInc[p] + fmGate * (invFmInc[p] - invInc[p]);
+					const float rise = static_cast<float>(static_cast<int32_t>(ph)) * invStep;
+					const float fall = static_cast<float>(static_cast<int32_t>(ph - 0x80000000)) * invStep;
+					value[p] = level[p] * (naive + Blep(rise) - Blep(fall));
+				} else {
+					value[p] = level[p] * naive;
+				}
+			}
+
+			float output = 0.0f;							// Summed separately so the partial loop has no loop carried dependency
+			for (uint32_t p = 0; p < partials; ++p) {
+				output += value[p];
+			}
+			out[i] = output;
+		}
+	}
+
+private:
+	static constexpr float nyquist = systemSampleRate * 0.49f;
+
+	uint32_t phase[partials] = {};
+	uint32_t inc[partials] = {};
+	uint32_t fmInc[partials] = {};
+	uint32_t source[partials] = {};		// Partial providing frequency modulation
+	float invInc[partials];				// Reciprocal increments convert phase distance to samples for the PolyBLEP
+	float invFmInc[partials];
+	float level[partials] = {};
+
+	static float Blep(const float x)	// Polynomial residual for a rising square edge x samples away
+	{
+		// -(1 - x)^2 just after the edge, (1 + x)^2 just before it and zero more than a sample away
+		const float d = 1.0f - std::abs(x);
+		const float a = 0.5f * (d + std::abs(d));			// max(d, 0) without a compare so the loop vectorises
+		return -std::copysign(a * a, x);
+	}
+};
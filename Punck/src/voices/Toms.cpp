@@ -6,18 +6,18 @@
 
 void Toms::Play(const uint8_t voice, const uint32_t noteOffset, const uint32_t noteRange, const float velocity)
 {
+	if (cacheReading) {
+		cache.Release();
+	}
 	playing = true;
-	phase = Phase::Ramp;
-
-	currentLevel = 0.0f;
 	velocityScale = velocity;
 
-	pitchScale = 1.0f + 1.5f * static_cast<float>(noteOffset) / (noteRange == 0 ? 128 : noteRange);
-
-	for (uint8_t i = 0; i < partialCount; ++i) {
-		position[i] = 2.0f;
-		sineInc[i] = config.sineFreqScale[1] * FreqToInc(config.baseFreq) * pitchScale;
-		sineLevel[i] = config.sineInitLevel[i];
+	// Play back from the render cache if it holds this pitch, otherwise synthesise the whole hit
+	lastKey.pitchScale = 1.0f + 1.5f * static_cast<float>(noteOffset) / (noteRange == 0 ? 128 : noteRange);
+	cacheReading = cache.Acquire(lastKey);
+	cachePosition = 0;
+	if (!cacheReading) {
+		Start(lastKey);
 	}
 }
 
@@ -29,48 +29,143 @@ void Toms::Play(const uint8_t voice, const uint32_t index)
 }
 
 
-void Toms::CalcOutput()
+void Toms::Start(const CacheKey& key)
 {
-	switch (phase) {
-	case Phase::Ramp:
-		currentLevel = currentLevel + (config.rampInc * (1.0f - currentLevel));
+	pitchScale = key.pitchScale;
+
+	using Curve = EnvSegment::Curve;
+	envelope.segment[Ramp] = {Curve::exponential, 1.0f - RampRate(config.rampInc), 1.0f, 0.93f};
+	envelope.segment[Sine] = {Curve::linear, 0.0f, 0.0f, 1.0f, EnvSegment::unending, 1.0f};
+	envelope.Start(PhaseCount);
+
+	for (uint8_t i = 0; i < partialCount; ++i) {
+		position[i] = SineOsc::Phase(2.0f);
+		sineInc[i] = SineOsc::PhaseInc(config.sineFreqScale[1] * FreqToInc(config.baseFreq) * pitchScale);
+		partialEnvelope[i].segment[0] = {Curve::exponential, DecayRate(config.decaySpeed[i]), 0.0f, 0.0f};
+		partialEnvelope[i].Start(1, config.sineInitLevel[i]);
+	}
+}
 
-		if (currentLevel > 0.93f) {
-			phase = Phase::Sine;
+
+uint32_t Toms::Synthesise(float* out, const uint32_t frames)
+{
+	// Writes the hit at unity velocity, returning the number of frames written before the envelope finished
+	uint32_t i = 0;
+	if (envelope.Segment() == Ramp) {
+		i = envelope.RenderSegment(out, frames);
+	}
+
+	if (envelope.Segment() == Sine && i < frames) {
+		// Partial levels are rendered a block at a time then applied to the sine partials
+		const uint32_t count = frames - i;
+		float partialLevel[partialCount][audioBlockSize];
+		const float slowDownRate = DecayRate(config.sineSlowDownRate);
+		uint32_t pos[partialCount];
+		float inc[partialCount];
+		for (uint8_t p = 0; p < partialCount; ++p) {
+			pos[p] = position[p];
+			inc[p] = sineInc[p];
+			partialEnvelope[p].Render(partialLevel[p], count);
 		}
-		break;
-
-	case Phase::Sine:
-	{
-		currentLevel = 0;
-		for (uint8_t i = 0; i < partialCount; ++i) {
-			sineInc[i] *= config.sineSlowDownRate;			// Sine wave slowly decreases in frequency
-			position[i] += sineInc[i];						// Set current poition in sine wave
-			sineLevel[i] *= config.decaySpeed[i];
-			currentLevel += std::sin(position[i]) * sineLevel[i];
+
+		for (uint32_t s = 0; s < count; ++s) {
+			float level = 0.0f;
+			for (uint8_t p = 0; p < partialCount; ++p) {
+				inc[p] *= slowDownRate;						// Sine wave slowly decreases in frequency
+				level += SineOsc::Next(pos[p], inc[p]) * partialLevel[p][s];
+			}
+			out[i + s] = level;
+		}
+		i = frames;
+
+		for (uint8_t p = 0; p < partialCount; ++p) {
+			position[p] = pos[p];
+			sineInc[p] = inc[p];
 		}
 
-		if (sineLevel[0] <= 0.00001f) {
-			playing = false;
-			phase = Phase::Off;
+		if (partialEnvelope[0].Level() <= 0.00001f) {
+			envelope.Stop();
 		}
-		break;
 	}
+	return i;
+}
 
-	default:
-		break;
+
+void Toms::Render(float* outL, float* outR, const uint32_t frames)
+{
+	uint32_t active = 0;
+	if (cacheReading) {
+		active = cache.Read(cachePosition, outL, frames, velocityScale);
+
+		if (cache.Finished(cachePosition)) {
+			// Continue with live synthesis from the voice state at the end of the cached buffer
+			const CacheSnapshot& snapshot = cache.State();
+			envelope = snapshot.envelope;
+			for (uint8_t p = 0; p < partialCount; ++p) {
+				partialEnvelope[p] = snapshot.partialEnvelope[p];
+				position[p] = snapshot.position[p];
+				sineInc[p] = snapshot.sineInc[p];
+			}
+			cache.Release();
+			cacheReading = false;
+		}
+	}
+
+	if (!cacheReading && active < frames) {
+		float* out = &outL[active];
+		const uint32_t count = Synthesise(out, frames - active);
+		const float scale = velocityScale;
+		for (uint32_t i = 0; i < count; ++i) {
+			out[i] *= scale;
+		}
+		active += count;
+	}
+
+	uint32_t i = 0;
+	for (; i < active; ++i) {
+		outR[i] = outL[i];
 	}
+	for (; i < frames; ++i) {
+		outL[i] = 0.0f;
+		outR[i] = 0.0f;
+	}
+
+	playing = cacheReading || envelope.Active();
+}
+
 
-	if (phase != Phase::Off) {
-		outputLevel[0] = velocityScale * currentLevel;
-		outputLevel[1] = outputLevel[0];
+void Toms::Stop()
+{
+	if (cacheReading) {
+		cache.Release();
+		cacheReading = false;
 	}
+	playing = false;
+	envelope.Stop();
 }
 
 
 void Toms::UpdateFilter()
 {
-
+	// Called for every voice in the pool: the shared cache is re-rendered once the last played pitch and configuration settle
+	const CacheKey key = lastKey;
+	cache.Update(key, [&](float* buffer, const uint32_t capacity, float* blockLevel, CacheSnapshot& snapshot) {
+		Toms renderer = *this;
+		renderer.Start(key);
+
+		uint32_t length = 0;
+		for (uint32_t block = 0; length < capacity && renderer.envelope.Active(); ++block) {
+			length += renderer.Synthesise(&buffer[length], std::min(audioBlockSize, capacity - length));
+			blockLevel[block] = renderer.partialEnvelope[0].Level();
+		}
+		snapshot.envelope = renderer.envelope;
+		for (uint8_t p = 0; p < partialCount; ++p) {
+			snapshot.partialEnvelope[p] = renderer.partialEnvelope[p];
+			snapshot.position[p] = renderer.position[p];
+			snapshot.sineInc[p] = renderer.sineInc[p];
+		}
+		return length;
+	});
 }
 
 
@@ -86,6 +181,7 @@ void Toms::StoreConfig(uint8_t* buff, const uint32_t len)
 	if (buff != nullptr && len <= sizeof(config)) {
 		memcpy(&config, buff, len);
 	}
+	++lastKey.configVersion;					// Invalidates the render cache
 }
 
 
@@ -2,14 +2,18 @@
 #include "initialisation.h"
 #include "Filter.h"
 #include "DrumVoice.h"
+#include "SineOsc.h"
+#include "Envelope.h"
+#include "RenderCache.h"
 
 class NoteMapper;
 
-class Toms : public DrumVoice {
+class Toms final : public DrumVoice {
 public:
 	void Play(const uint8_t voice, const uint32_t noteOffset, const uint32_t noteRange, const float velocity);
 	void Play(const uint8_t voice, const uint32_t index);
-	void CalcOutput();
+	void Render(float* outL, float* outR, const uint32_t frames);
+	void Stop();
 	void UpdateFilter();
 	uint32_t SerialiseConfig(uint8_t** buff, const uint8_t voiceIndex);
 	void StoreConfig(uint8_t* buff, const uint32_t len);
@@ -17,18 +21,46 @@ public:
 
 	NoteMapper* noteMapper;
 
+	// Start of a hit at the most recently played pitch is pre-rendered and shared by all voices in the pool: up to 170ms at
+	// 48kHz (21ms at 96kHz) from the RAM_D2 pool shared with the reverb diffusers (see main.cpp)
+	static constexpr uint32_t cacheSize = (systemSampleRate == 48000) ? 8192 : 2048;
+	static bool InvalidateCache()	{ return cache.Invalidate(); }
+	static void FreeCache()			{ cache.FreeBuffer(); }
+
 private:
-	enum class Phase {Off, Ramp, Sine} phase;
+	enum Phase : uint8_t {Ramp, Sine, PhaseCount};
 	static constexpr uint8_t partialCount = 2;
 
-	float position[partialCount];
-	float currentLevel;
+	Envelope<PhaseCount> envelope;							// Initial ramp then held while the partials sound
+	Envelope<1> partialEnvelope[partialCount];				// Decay of each sine partial
+
+	uint32_t position[partialCount];
 	float velocityScale;
 
-	float sineInc[partialCount];
-	float sineLevel[partialCount];
+	float sineInc[partialCount];			// In SineOsc phase units
 	float pitchScale;						// Note index allows different frequency notes
 
+	struct CacheKey {
+		float pitchScale;
+		uint32_t configVersion;
+
+		bool Matches(const CacheKey& k) const {
+			return pitchScale == k.pitchScale && configVersion == k.configVersion;
+		}
+	};
+
+	struct CacheSnapshot {					// Synthesis state at the end of the cached buffer
+		Envelope<PhaseCount> envelope;
+		Envelope<1> partialEnvelope[partialCount];
+		uint32_t position[partialCount];
+		float sineInc[partialCount];
+	};
+
+	static inline RenderCache<CacheKey, CacheSnapshot, cacheSize> cache{ramD2Arena};
+	static inline CacheKey lastKey;			// Pitch of the most recent note and current configuration
+	uint32_t cachePosition;
+	bool cacheReading = false;				// Note is playing back from the render cache
+
 	struct Config {
 		float decaySpeed[partialCount] = {0.9995f, 0.9993f};	// Volume decay speed
 		float rampInc = 0.2f;									// Initial wave steep ramp
@@ -38,5 +70,7 @@ private:
 		float sineSlowDownRate = 0.99995f;						// Rate of decrease of sine frequency
 	} config;
 
+	void Start(const CacheKey& key);
+	uint32_t Synthesise(float* out, const uint32_t frames);
 };
 
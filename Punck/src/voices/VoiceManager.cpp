@@ -2,6 +2,7 @@
 #include "VoiceManager.h"
 #include "Sequencer.h"
 #include "reverb.h"
+#include "CpuGovernor.h"
 
 VoiceManager voiceManager;
 
@@ -21,7 +22,7 @@ VoiceManager::VoiceManager()
 	k.midiHigh = 84;
 
 	NoteMapper& s = noteMapper[Voice::snare];
-	snarePlayer.noteMapper = &s;
+	snarePlayer.SetNoteMapper(&s);
 	s.drumVoice = &snarePlayer;
 	s.trigger = {GPIOB, 5, GPIOD, 3};
 	s.pwmLed = {&TIM8->CCR3};			// PC8: Red
@@ -55,16 +56,22 @@ VoiceManager::VoiceManager()
 	sb.midiHigh = 71;
 
 	NoteMapper& t = noteMapper[Voice::toms];
-	tomsPlayer.noteMapper = &k;
+	tomsPlayer.SetNoteMapper(&k);
 	t.drumVoice = &tomsPlayer;
 	t.midiLow = 56;
 	t.midiHigh = 59;
 
 	NoteMapper& c = noteMapper[Voice::claps];
-	clapsPlayer.noteMapper = &c;
+	clapsPlayer.SetNoteMapper(&c);
 	c.drumVoice = &clapsPlayer;
 	c.midiLow = 83;
 	c.midiHigh = 83;
+
+	NoteMapper& r = noteMapper[Voice::ride];
+	ridePlayer.noteMapper = &r;
+	r.drumVoice = &ridePlayer;
+	r.midiLow = 85;						// Bow and bell
+	r.midiHigh = 86;
 }
 
 
@@ -76,44 +83,58 @@ uint32_t leftOverflow = 0, rightOverflow = 0;	// Debug
 //uint32_t waitCrossing = 0;
 constexpr float adjOffset = 0.0f;
 constexpr float adjOutputScale = 0.92f;
-void VoiceManager::Output()
+void VoiceManager::Output(int32_t* outputBuffer)
 {
-	CheckButtons();										// Handle buttons playing note or activating MIDI learn
-	sequencer.Play();
-
-/*
-	// Test code for calculating offsets and maximum levels before ADC distorts
-	leftOutput += outInc;
-	if (std::abs(leftOutput) > 1.0f) {
-		leftOutput = (leftOutput > 0.0f) ? 1.0f : -1.0f;
-		outInc *= -1.0f;
-		waitCrossing = 0;
-	}
-	if (leftOutput <= 0.0f && outInc < 0.0f && waitCrossing < 10000) {
-		leftOutput = 0.0f;
-		waitCrossing++;
-	}
-	rightOutput = leftOutput;
-*/
+	// Render a block of audioBlockSize interleaved stereo frames into the idle half of the I2S DMA buffer
+	const uint16_t renderStart = TIM3->CNT;
+	const uint32_t blockStart = nextBlockFrame;
+	ControlTick();										// Buttons, sequencer and LEDs: sequencer and trigger notes are queued for this block
+
+	// Collect notes due in this block from each producer queue, sorted by frame offset (late notes play at the start of the block)
+	blockEventCount = 0;
+	uint32_t eventVoices = 0;
+	for (auto& queue : noteQueue) {
+		while (blockEventCount < maxBlockEvents) {
+			const NoteEvent* event = queue.Peek();
+			if (event == nullptr) {
+				break;
+			}
+			const int32_t offset = static_cast<int32_t>(event->frame - blockStart);
+			if (offset >= static_cast<int32_t>(audioBlockSize)) {
+				break;									// Events in each queue are in time order so remainder are due in later blocks
+			}
 
-	float combinedOutput[2] = {0.0f, 0.0f};
-	for (auto& nm : noteMapper) {
-		if (nm.drumVoice != nullptr && nm.voiceIndex == 0) {			// If voiceIndex is > 0 drum voice has multiple channels (eg sampler)
-			combinedOutput[left]  += nm.drumVoice->outputLevel[left];
-			combinedOutput[right] += nm.drumVoice->outputLevel[right];
+			const uint32_t frameOffset = offset > 0 ? offset : 0;
+			uint32_t pos = blockEventCount++;
+			while (pos > 0 && blockEvents[pos - 1].offset > frameOffset) {
+				blockEvents[pos] = blockEvents[pos - 1];
+				--pos;
+			}
+			blockEvents[pos] = {frameOffset, *event};
+			eventVoices |= noteMapper[event->voice].ActiveBit();
+			queue.Pop();
 		}
 	}
 
+	// Render and mix only voices that are sounding or starting: the first voice mixed overwrites the mix and send buffers
+	bool mixEmpty = true;
+	bool sendEmpty = true;
+	RenderVoices(activeVoices | eventVoices, mixEmpty, sendEmpty, std::make_index_sequence<std::tuple_size_v<decltype(VoiceRegistry())>>{});
 
-	if (std::abs(combinedOutput[left])  > 1.0f) { ++leftOverflow; }		// Debug
-	if (std::abs(combinedOutput[right]) > 1.0f) { ++rightOverflow; }
+	if (mixEmpty) {
+		std::fill(&mixBuffer[left][0], &mixBuffer[left][0] + audioBlockSize * 2, 0.0f);
+	}
+	if (sendEmpty) {
+		std::fill(&sendBuffer[left][0], &sendBuffer[left][0] + audioBlockSize * 2, 0.0f);		// Reverb still runs to play out tail
+	}
 
-	// reverb
 #if (TIMINGDEBUG)
 	uint32_t reverbStart = TIM3->CNT;
 #endif
 
-	auto [reverbL, reverbR] = reverb.Process(combinedOutput[left], combinedOutput[right]);
+	// Send buffers are replaced with the reverb output
+	reverb.FilterInput(sendBuffer[left], sendBuffer[right], audioBlockSize);
+	reverb.Process(sendBuffer[left], sendBuffer[right], audioBlockSize);
 
 #if (TIMINGDEBUG)
 	reverbTime = TIM3->CNT - reverbStart;
@@ -122,31 +143,169 @@ void VoiceManager::Output()
 	}
 #endif
 
-	// Apply some soft clipping
-	combinedOutput[left] = FastTanh(combinedOutput[left] + reverbL);
-	combinedOutput[right] = FastTanh(combinedOutput[right] + reverbR);
+	const float outputScale = 2147483648.0f * adjOutputScale;
+	for (uint32_t frame = 0; frame < audioBlockSize; ++frame) {
+		float combinedOutput[2] = {mixBuffer[left][frame], mixBuffer[right][frame]};
 
+		if (std::abs(combinedOutput[left])  > 1.0f) { ++leftOverflow; }	// Debug
+		if (std::abs(combinedOutput[right]) > 1.0f) { ++rightOverflow; }
 
-	const float outputScale = 2147483648.0f * adjOutputScale;
-	SPI2->TXDR = (int32_t)((combinedOutput[left] + adjOffset) *  outputScale);
-	SPI2->TXDR = (int32_t)((combinedOutput[right] + adjOffset) * outputScale);
+		// Apply some soft clipping
+		combinedOutput[left] = FastTanh(combinedOutput[left] + sendBuffer[left][frame]);
+		combinedOutput[right] = FastTanh(combinedOutput[right] + sendBuffer[right][frame]);
+
+		outputBuffer[frame * 2]     = (int32_t)((combinedOutput[left] + adjOffset) *  outputScale);
+		outputBuffer[frame * 2 + 1] = (int32_t)((combinedOutput[right] + adjOffset) * outputScale);
+	}
+
+	nextBlockFrame = blockStart + audioBlockSize;
+
+	// Debug timer is 16 bit: wrapping subtraction is valid as the largest block is shorter than the timer period
+	cpuGovernor.Update(static_cast<uint16_t>(TIM3->CNT - renderStart));
+}
 
-	for (auto& nm : noteMapper) {
-		if (nm.drumVoice != nullptr && nm.voiceIndex == 0) {			// If voiceIndex is > 0 drum voice has multiple channels (eg sampler)
-			nm.drumVoice->PlayQueued();			// MIDI notes will be queued from serial/usb interrupts to play in main I2S interrupt
+
+template <std::size_t... I>
+void VoiceManager::RenderVoices(const uint32_t voices, bool& mixEmpty, bool& sendEmpty, std::index_sequence<I...>)
+{
+	auto registry = VoiceRegistry();
+	(RenderVoice(std::get<I>(registry), noteMapper[registryVoice[I]], voices, mixEmpty, sendEmpty), ...);
+}
+
+
+template <typename T>
+void VoiceManager::RenderVoice(T& voice, NoteMapper& nm, const uint32_t voices, bool& mixEmpty, bool& sendEmpty)
+{
+	if ((voices & nm.ActiveBit()) == 0) {
+		return;
+	}
+
+	// The sampler renders each player separately so they can be mixed to their own mixer channels
+	constexpr uint8_t outputs = std::is_same_v<T, Samples> ? 2 : 1;
+
+	// A note starting on the voice in this block cancels a pending steal by the CPU governor
+	for (uint32_t e = 0; e < blockEventCount; ++e) {
+		if (noteMapper[blockEvents[e].event.voice].ActiveBit() == nm.ActiveBit()) {
+			stealVoices &= ~nm.ActiveBit();
+		}
+	}
+	const bool steal = stealVoices & nm.ActiveBit();
 
 #if (TIMINGDEBUG)
-			uint32_t debugStart = TIM3->CNT;
+	uint32_t debugStart = TIM3->CNT;
 #endif
-			nm.drumVoice->CalcOutput();
-#if (TIMINGDEBUG)
-			nm.drumVoice->debugTime = TIM3->CNT - debugStart;
-			if (nm.drumVoice->debugTime > nm.drumVoice->debugMaxTime) {
-				nm.drumVoice->debugMaxTime = nm.drumVoice->debugTime;
+	for (uint8_t out = 0; out < outputs; ++out) {
+		const uint8_t channel = nm.voice + out;
+
+		if constexpr (outputs > 1) {
+			bool noteStarting = false;
+			for (uint32_t e = 0; e < blockEventCount; ++e) {
+				noteStarting |= (blockEvents[e].event.voice == channel);
+			}
+			if (!voice.sampler[out].playing && !noteStarting) {
+				continue;
+			}
+		}
+
+		auto render = [&](const uint32_t pos, const uint32_t frames) {
+			if constexpr (outputs > 1) {
+				voice.RenderPlayer(out, &voiceBuffer[left][pos], &voiceBuffer[right][pos], frames);
+			} else {
+				voice.Render(&voiceBuffer[left][pos], &voiceBuffer[right][pos], frames);
+			}
+		};
+
+		// Split the block at each note start for this channel so notes start at the correct frame
+		uint32_t pos = 0;
+		for (uint32_t e = 0; e < blockEventCount; ++e) {
+			const BlockEvent& be = blockEvents[e];
+			if (be.event.voice == channel) {
+				if (be.offset > pos) {
+					render(pos, be.offset - pos);
+					pos = be.offset;
+				}
+				nm.noteStart = nextBlockFrame + be.offset;
+				if (be.event.button) {
+					voice.Play(noteMapper[channel].voiceIndex, be.event.noteOffset);
+				} else {
+					voice.Play(noteMapper[channel].voiceIndex, be.event.noteOffset, be.event.noteRange, be.event.velocity);
+				}
 			}
+		}
+		render(pos, audioBlockSize - pos);
+
+		if (steal) {
+			// Voice stolen by CPU governor: fade out over the block to avoid a click
+			const float fadeInc = 1.0f / audioBlockSize;
+			for (uint32_t i = 0; i < audioBlockSize; ++i) {
+				const float fade = 1.0f - fadeInc * i;
+				voiceBuffer[left][i] *= fade;
+				voiceBuffer[right][i] *= fade;
+			}
+		}
+
+		mixer.Mix(channel, voiceBuffer[left], voiceBuffer[right], mixBuffer[left], mixBuffer[right], sendBuffer[left], sendBuffer[right], mixEmpty, sendEmpty);
+	}
+
+#if (TIMINGDEBUG)
+	voice.debugTime = TIM3->CNT - debugStart;
+	if (voice.debugTime > voice.debugMaxTime) {
+		voice.debugMaxTime = voice.debugTime;
+	}
 #endif
+
+	if (steal) {
+		voice.Stop();
+		stealVoices &= ~nm.ActiveBit();
+	}
+
+	// Update active set: voice has either started or finished during this block (Render will have silenced the remainder)
+	if (voice.playing) {
+		activeVoices |= nm.ActiveBit();
+	} else {
+		activeVoices &= ~nm.ActiveBit();
+		voice.outputLevel[left] = 0.0f;
+		voice.outputLevel[right] = 0.0f;
+	}
+}
+
+
+bool VoiceManager::StealOldestVoice()
+{
+	// Schedule the voice with the oldest note to be faded out in the next block; the last sounding voice is never stolen
+	const uint32_t candidates = activeVoices & ~stealVoices;
+	if (__builtin_popcount(candidates) < 2) {
+		return false;
+	}
+
+	NoteMapper* oldest = nullptr;
+	for (Voice v : registryVoice) {
+		NoteMapper& nm = noteMapper[v];
+		if ((candidates & nm.ActiveBit()) && (oldest == nullptr || nextBlockFrame - nm.noteStart > nextBlockFrame - oldest->noteStart)) {
+			oldest = &nm;
 		}
 	}
+	stealVoices |= oldest->ActiveBit();
+	return true;
+}
+
+
+uint32_t VoiceManager::EventFrame()
+{
+	// Timestamp for notes arriving in other interrupts: frames already played from the current DMA half are added to the start
+	// of the next block so notes are delayed by a constant two blocks rather than being quantised to block boundaries.
+	// If a half or full transfer interrupt is pending the DMA has moved into the next half but the audio interrupt has not yet
+	// advanced nextBlockFrame, so the position counts from one block later
+	auto framesSent = []() { return (audioBlockSize * 4 - DMA1_Stream3->NDTR) / 2; };	// Position in the whole ping-pong buffer
+
+	uint32_t frame, position, pending;
+	do {
+		frame = nextBlockFrame;
+		position = framesSent();
+		pending = DMA1->LISR & (DMA_LISR_HTIF3 | DMA_LISR_TCIF3);
+	} while (frame != nextBlockFrame ||										// Audio interrupt rendered a block while reading
+			position / audioBlockSize != framesSent() / audioBlockSize);	// DMA changed half while the flags were read
+	return frame + position % audioBlockSize + (pending ? audioBlockSize : 0);
 }
 
 
@@ -160,7 +319,7 @@ float VoiceManager::FastTanh(const float x)
 }
 
 
-void VoiceManager::NoteOn(MidiHandler::MidiNote midiNote)
+void VoiceManager::NoteOn(MidiHandler::MidiNote midiNote, const MidiHandler::MidiSource source)
 {
 	if (buttonMode == ButtonMode::midiLearn) {
 		NoteMapper& n = noteMapper[midiLearnVoice];
@@ -186,20 +345,68 @@ void VoiceManager::NoteOn(MidiHandler::MidiNote midiNote)
 		}
 	} else {
 		// Locate voice and queue note (notes are only triggered in the main interrupt to avoid data corruption)
+		EventQueue<NoteEvent>& queue = noteQueue[source == MidiHandler::MidiSource::usb ? usbMidiSource : serialMidiSource];
+		const uint32_t frame = EventFrame();
 		for (auto& note : noteMapper) {
-			if (midiNote.noteValue >= note.midiLow && midiNote.noteValue <= note.midiHigh) {
-				const uint32_t noteOffset = midiNote.noteValue - note.midiLow;
-				const uint32_t noteRange = note.midiHigh - note.midiLow + 1;
+			if (midiNote.noteValue >= note.midiLow && midiNote.noteValue <= note.midiHigh && note.drumVoice) {
+				const uint8_t noteOffset = midiNote.noteValue - note.midiLow;
+				const uint8_t noteRange = note.midiHigh - note.midiLow + 1;
+				queue.Push({frame, note.voice, false, noteOffset, noteRange, static_cast<float>(midiNote.velocity) / 127.0f});
+			}
+		}
+	}
+}
 
-				if (note.drumVoice) {
-					note.drumVoice->QueuePlay(note.voiceIndex, noteOffset, noteRange, static_cast<float>(midiNote.velocity) / 127.0f);
-				}
+
+void VoiceManager::QueueNote(const NoteSource source, const uint32_t frameOffset, const uint8_t voice, const uint32_t noteOffset, const uint32_t noteRange, const float velocity)
+{
+	// Queue note from a producer running in the audio interrupt (sequencer) to start at an offset into the current block
+	noteQueue[source].Push({nextBlockFrame + frameOffset, voice, false, static_cast<uint8_t>(noteOffset), static_cast<uint8_t>(noteRange), velocity});
+}
+
+
+void VoiceManager::QueueButton(const uint32_t frameOffset, const uint8_t voice, const uint32_t index)
+{
+	// Queue note from button or trigger input: voice pots are used to select note
+	noteQueue[triggerSource].Push({nextBlockFrame + frameOffset, voice, true, static_cast<uint8_t>(index), 0, 1.0f});
+}
+
+
+void VoiceManager::ControlTick()
+{
+	// Control rate processing, called once per audio block: the audio path only consumes values calculated here
+	SmoothADC();										// Smooth pot and CV readings used by voices and sequencer
+	CheckButtons();										// Handle buttons playing note or activating MIDI learn
+	sequencer.Play(audioBlockSize);
+
+	// In MIDI learn mode LEDs are used to show learn state and while all LEDs are overridden they are left as set; otherwise
+	// update brightness from voice envelopes
+	if (buttonMode != ButtonMode::midiLearn && !ledOverride) {
+		for (auto& nm : noteMapper) {
+			if (nm.pwmLed.timerChannel) {
+				nm.pwmLed.Level(nm.ledLevel);
 			}
 		}
 	}
 }
 
 
+void VoiceManager::SmoothADC()
+{
+	// One pole low pass of each ADC reading. Filter cutoff controls are smoothed separately in the idle loop (see FilterControl)
+	if (!adcPrimed) {
+		for (uint32_t i = 0; i < adcCount; ++i) {
+			adcSmoothed[i] = ADC_array[i];
+		}
+		adcPrimed = true;
+	}
+	for (uint32_t i = 0; i < adcCount; ++i) {
+		adcSmoothed[i] += adcSmoothing * (static_cast<float>(ADC_array[i]) - adcSmoothed[i]);
+		controlADC[i] = static_cast<uint16_t>(adcSmoothed[i]);
+	}
+}
+
+
 void VoiceManager::CheckButtons()
 {
 	// Check mode select switch. Options: Play note; MIDI learn; drum pattern selector
@@ -213,17 +420,21 @@ void VoiceManager::CheckButtons()
 			midiLearnCounter = 0;
 		} else {
 			// Pulse LED to show MIDI Learn state - slow is low note, fast is high note
-			midiLearnCounter += midiLearnState == MidiLearnState::lowNote ? 5 : 10;
+			midiLearnCounter = (midiLearnCounter + (midiLearnState == MidiLearnState::lowNote ? 5 : 10) * static_cast<uint32_t>(audioBlockSize / sampleRateScale)) % midiLearnPeriod;
+			const float pulse = (midiLearnCounter < midiLearnPeriod / 2) ? 1.0f : 0.0f;
 
-			// Toms and claps do not have dedicated LEDs so pulse combinations
+			// Toms, claps and ride do not have dedicated LEDs so pulse combinations
 			if (midiLearnVoice == Voice::toms) {
-				noteMapper[Voice::kick].pwmLed.Level(midiLearnCounter > 0 ? 1.0f : 0.0f);
-				noteMapper[Voice::snare].pwmLed.Level(midiLearnCounter > 0 ? 1.0f : 0.0f);
+				noteMapper[Voice::kick].pwmLed.Level(pulse);
+				noteMapper[Voice::snare].pwmLed.Level(pulse);
 			} else if (midiLearnVoice == Voice::claps) {
-				noteMapper[Voice::samplerA].pwmLed.Level(midiLearnCounter > 0 ? 1.0f : 0.0f);
-				noteMapper[Voice::samplerB].pwmLed.Level(midiLearnCounter > 0 ? 1.0f : 0.0f);
+				noteMapper[Voice::samplerA].pwmLed.Level(pulse);
+				noteMapper[Voice::samplerB].pwmLed.Level(pulse);
+			} else if (midiLearnVoice == Voice::ride) {
+				noteMapper[Voice::hihat].pwmLed.Level(pulse);
+				noteMapper[Voice::samplerB].pwmLed.Level(pulse);
 			} else {
-				noteMapper[midiLearnVoice].pwmLed.Level(midiLearnCounter > 0 ? 1.0f : 0.0f);
+				noteMapper[midiLearnVoice].pwmLed.Level(pulse);
 			}
 		}
 	} else if ((GPIOC->IDR & GPIO_IDR_ID6) == 0) {		// PC6: Sequence Select
@@ -255,7 +466,7 @@ void VoiceManager::CheckButtons()
 
 				} else if (buttonMode == ButtonMode::playNote || triggerType != NoteMapper::TriggerType::triggerBtn) {
 					// Trigger input only used to play notes; Trigger 2 currently only used for open hihat
-					note.drumVoice->Play(note.voiceIndex, triggerType == NoteMapper::TriggerType::trigger2 ? 128 : 0);
+					QueueButton(0, note.voice, triggerType == NoteMapper::TriggerType::trigger2 ? 128 : 0);
 
 				} else if (buttonMode == ButtonMode::drumPattern) {
 					sequencer.StartStop(note.voice);
@@ -271,13 +482,24 @@ void VoiceManager::CheckButtons()
 
 void VoiceManager::IdleTasks()
 {
-	for (auto& nm : noteMapper) {
-		// If voiceIndex is > 0 drum voice has multiple channels (eg sampler)
-		// Calculate filters even when not playing so ready for next hit (coefficients will only be updated if cut off has changed)
-		if (nm.drumVoice != nullptr && nm.voiceIndex == 0) {
-			nm.drumVoice->UpdateFilter();
+	// Reverb delay lines are carved here rather than in the USB interrupt so the RAM_D2 arena is only changed from the idle loop.
+	// If the configured diffusers did not fit beside the hit caches, the caches give their memory back once no note is reading
+	// them and are allocated again from the space the diffusers leave
+	reverb.UpdateAllocation();
+	if (reverb.DiffusersShort()) {
+		const bool kickReleased = Kick::InvalidateCache();
+		const bool tomsReleased = Toms::InvalidateCache();
+		if (kickReleased && tomsReleased) {
+			Kick::FreeCache();
+			Toms::FreeCache();
+			ramD2Arena.ReleaseBottom();
+			reverb.RequestAllocation();
+			reverb.UpdateAllocation();
 		}
 	}
+
+	// Calculate filters even when not playing so ready for next hit (coefficients will only be updated if cut off has changed)
+	std::apply([](auto&... voice) { (voice.UpdateFilter(), ...); }, VoiceRegistry());
 }
 
 
@@ -290,6 +512,11 @@ uint32_t VoiceManager:: GetConfig(uint8_t** buff)
 		config[i++] = nm.midiHigh;
 	}
 	config[i++] = midiChannel;
+	config[i++] = snarePlayer.allocator.polyphony;
+	config[i++] = tomsPlayer.allocator.polyphony;
+	config[i++] = clapsPlayer.allocator.polyphony;
+	config[i++] = samples.sampler[Samples::playerA].allocator.polyphony;
+	config[i++] = samples.sampler[Samples::playerB].allocator.polyphony;
 	*buff = config;
 	return sizeof(config);
 }
@@ -304,6 +531,11 @@ uint32_t VoiceManager:: StoreConfig(uint8_t* buff)
 		nm.midiHigh = buff[i++];
 	}
 	midiChannel = buff[i++];
+	snarePlayer.allocator.SetPolyphony(buff[i++]);
+	tomsPlayer.allocator.SetPolyphony(buff[i++]);
+	clapsPlayer.allocator.SetPolyphony(buff[i++]);
+	samples.sampler[Samples::playerA].allocator.SetPolyphony(buff[i++]);
+	samples.sampler[Samples::playerB].allocator.SetPolyphony(buff[i++]);
 	return sizeof(config);
 }
 
@@ -311,6 +543,7 @@ uint32_t VoiceManager:: StoreConfig(uint8_t* buff)
 void VoiceManager::SetAllLeds(float val)
 {
 	// Used so one-off processes like config storing can flash all LEDs simultaneously and then restore settings
+	ledOverride = true;									// Stop control tick updating LEDs from voice levels until restored
 	for (auto& nm : voiceManager.noteMapper) {
 		if (nm.pwmLed.timerChannel) {
 			ledBackup[nm.voice] = *nm.pwmLed.timerChannel;
@@ -328,4 +561,5 @@ void VoiceManager::RestoreAllLeds()
 			*nm.pwmLed.timerChannel = ledBackup[nm.voice];
 		}
 	}
+	ledOverride = false;
 }
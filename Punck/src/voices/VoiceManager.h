@@ -8,7 +8,14 @@
 #include "HiHat.h"
 #include "Toms.h"
 #include "Claps.h"
+#include "Ride.h"
+#include "VoicePool.h"
+#include "EventQueue.h"
+#include "Mixer.h"
 #include <cstring>
+#include <tuple>
+#include <utility>
+#include <type_traits>
 
 struct NoteMapper {
 	enum  TriggerType: uint8_t {noTrigger = 0, triggerBtn = 1, trigger1 = 2, trigger2 = 4};
@@ -18,6 +25,13 @@ struct NoteMapper {
 	uint8_t midiLow;
 	uint8_t midiHigh;
 
+	float ledLevel = 0.0f;				// LED brightness set by voice when rendering; written to PWM timer at control rate
+	uint32_t noteStart = 0;				// Frame at which last note started: used to find the oldest voice when stealing
+
+	uint32_t ActiveBit() {				// Bit in VoiceManager active voice mask: voices with multiple channels share the bit of their first channel
+		return 1 << (voice - voiceIndex);
+	}
+
 	struct Trigger {
 		GPIO_TypeDef* btnGpioBank;
 		uint8_t btnGpioPin;
@@ -26,6 +40,7 @@ struct NoteMapper {
 		GPIO_TypeDef* tr2GpioBank;
 		uint8_t tr2GpioPin;
 
+		static constexpr uint8_t debounceTicks = (20 + audioBlockSize - 1) / audioBlockSize;	// Debounce of at least 20 samples in control ticks
 		uint8_t debounce = 0;
 		bool buttonOn;
 
@@ -35,10 +50,10 @@ struct NoteMapper {
 							   (tr2GpioBank && (tr2GpioBank->IDR & (1 << tr2GpioPin)) == 0) ? 4 : 0);
 			if (triggers) {		// Fixme - probably need different debounce on each trigger
 				if (debounce == 0) {
-					debounce = 20;
+					debounce = debounceTicks;
 					return triggers;
 				}
-				debounce = 20;
+				debounce = debounceTicks;
 			}
 			if (debounce > 0) {
 				--debounce;
@@ -65,17 +80,33 @@ struct NoteMapper {
 };
 
 
+struct NoteEvent {
+	uint32_t frame;						// Sample frame at which note should start
+	uint8_t voice;						// Index into noteMapper array
+	bool button;						// Button/trigger hits use voice pots to select note
+	uint8_t noteOffset;
+	uint8_t noteRange;
+	float velocity;
+};
+
+
 class VoiceManager {
 	friend class CDCHandler;
 public:
-	enum Voice {kick, snare, hihat, samplerA, samplerB, toms, claps, count};
+	enum Voice {kick, snare, hihat, samplerA, samplerB, toms, claps, ride, count};
+	enum NoteSource {usbMidiSource, serialMidiSource, sequencerSource, triggerSource, sourceCount};		// One event queue per producer
 
 	VoiceManager();
 	void VoiceLED(Voice v, bool on);
-	void NoteOn(MidiHandler::MidiNote midiNote);
-	void Output();
+	void NoteOn(MidiHandler::MidiNote midiNote, const MidiHandler::MidiSource source);
+	void QueueNote(const NoteSource source, const uint32_t frameOffset, const uint8_t voice, const uint32_t noteOffset, const uint32_t noteRange, const float velocity);
+	void QueueButton(const uint32_t frameOffset, const uint8_t voice, const uint32_t index);
+	void Output(int32_t* outputBuffer);
+	void ControlTick();
+	void SmoothADC();
 	void CheckButtons();
 	void IdleTasks();
+	bool StealOldestVoice();
 	void SetAllLeds(float val);
 	void RestoreAllLeds();
 
@@ -84,27 +115,62 @@ public:
 	uint32_t StoreConfig(uint8_t* buff);						// Reads config data back into member values
 
 	Kick kickPlayer;
-	Snare snarePlayer;
+	VoicePool<Snare, 5> snarePlayer;							// Voices with long tails are pooled so repeated notes can overlap
 	Samples samples;
 	HiHat hihatPlayer;
-	Toms tomsPlayer;
-	Claps clapsPlayer;
+	VoicePool<Toms, 5> tomsPlayer;
+	VoicePool<Claps, 4> clapsPlayer;
+	Ride ridePlayer;
+	Mixer mixer;
 
 	NoteMapper noteMapper[Voice::count];
 	uint8_t midiChannel = 0;
+	uint32_t activeVoices = 0;									// Bit mask of sounding voices: only these are rendered and mixed
+	uint32_t stealVoices = 0;									// Bit mask of voices to be faded out and stopped in next block
+	volatile uint32_t nextBlockFrame = 0;						// Sample frame at start of block being rendered (updated to next block when complete)
+	EventQueue<NoteEvent> noteQueue[sourceCount];
 
 private:
 	float FastTanh(const float x);
-	uint8_t config[Voice::count * 2];							// Buffer to store config data (currently used to store midi note mapping]
+	uint32_t EventFrame();
+
+	// Compile time voice registry: the audio loop iterates this with fold expressions so render and play calls are bound statically
+	// to the final voice classes rather than through DrumVoice virtual dispatch (config and serialisation still use the virtual interface)
+	auto VoiceRegistry() { return std::tie(kickPlayer, snarePlayer, hihatPlayer, samples, tomsPlayer, clapsPlayer, ridePlayer); }
+	static constexpr Voice registryVoice[] = {kick, snare, hihat, samplerA, toms, claps, ride};		// noteMapper entry of each registered voice
+
+	template <typename T> void RenderVoice(T& voice, NoteMapper& nm, const uint32_t voices, bool& mixEmpty, bool& sendEmpty);
+	template <std::size_t... I> void RenderVoices(const uint32_t voices, bool& mixEmpty, bool& sendEmpty, std::index_sequence<I...>);
+	uint8_t config[Voice::count * 2 + 5];						// Buffer to store config data: midi note mapping, midi channel and polyphony
 
 	enum class ButtonMode {playNote, midiLearn, drumPattern};
 	enum class MidiLearnState {off, lowNote, highNote};
 	ButtonMode buttonMode;
 	uint8_t midiLearnVoice;
 	MidiLearnState midiLearnState;
-	int16_t midiLearnCounter;
+	uint32_t midiLearnCounter;
+	static constexpr uint32_t midiLearnPeriod = 65536;			// LED pulse is lit for the first half of each period
+
+	static constexpr uint32_t adcCount = ADC1_BUFFER_LENGTH + ADC2_BUFFER_LENGTH;
+	static constexpr float adcSmoothing = audioBlockSize / (systemSampleRate * 0.01f);	// One pole coefficient: 10ms time constant
+	float adcSmoothed[adcCount];
+	bool adcPrimed = false;										// Smoothing starts from the first reading rather than zero
 	uint32_t ledBackup[Voice::count];
+	volatile bool ledOverride = false;					// Set while SetAllLeds is active so control tick does not overwrite LEDs
+
+	float voiceBuffer[2][audioBlockSize];						// Block rendered by each voice in turn
+	float mixBuffer[2][audioBlockSize];							// Sum of all voices for current block
+	float sendBuffer[2][audioBlockSize];						// Reverb send bus
+
+	static constexpr uint32_t maxBlockEvents = 32;
+	struct BlockEvent {
+		uint32_t offset;										// Frame offset of note in current block
+		NoteEvent event;
+	} blockEvents[maxBlockEvents];								// Notes due in current block sorted by offset
+	uint32_t blockEventCount = 0;
 
 };
 
+static_assert(Mixer::channels == VoiceManager::Voice::count, "Mixer must have a channel for each voice");
+
 extern VoiceManager voiceManager;
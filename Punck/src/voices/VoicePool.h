@@ -0,0 +1,293 @@
+#pragma once
+
+#include "initialisation.h"
+#include "DrumVoice.h"
+
+class NoteMapper;
+
+// Fixed capacity slot allocator for polyphonic voices. Free slots are found in O(1) from a bit mask; when the polyphony limit
+// is reached the oldest or quietest voice is stolen and faded out in its own slot while the new note starts in a spare slot. If
+// notes arrive faster than the fades complete there is no spare slot: the fading voice nearest the end of its fade is restarted
+// and the caller renders the rest of its fade into the tail buffer first (see RenderTail), so no voice is ever cut off
+
+template<uint32_t N>
+class VoiceAllocator {
+	static_assert(N >= 2 && N <= 32, "Voice allocator capacity must be between 2 and 32");
+public:
+	static constexpr uint32_t maxPolyphony = N - 1;			// One slot is kept spare so a stolen voice can fade out
+	static constexpr uint32_t slotMask = (N == 32) ? 0xFFFFFFFF : ((1UL << N) - 1);
+	static constexpr float fadeInc = 1.0f / (96.0f * sampleRateScale);	// Stolen voices fade out over 2ms
+	static constexpr uint32_t tailSize = (static_cast<uint32_t>(96.0f * sampleRateScale) / audioBlockSize + 1) * audioBlockSize;	// Holds a full fade
+	enum class StealMode : uint8_t {oldest, quietest};
+
+	uint8_t polyphony = 2;
+	StealMode stealMode = StealMode::quietest;
+	uint32_t active = 0;									// Bit mask of sounding slots (including those fading out)
+	uint32_t fading = 0;									// Bit mask of stolen slots fading out
+	float peak[N];											// Peak level of each slot in last rendered block: used to find quietest voice
+	bool restart = false;									// Set by Allocate if the slot holds a voice still fading out
+
+	uint32_t Allocate()
+	{
+		// Returns the slot to start a new note in, stealing a voice if the polyphony limit has been reached. If restart is set the
+		// caller must pass the slot's old voice to RenderTail before starting the new note
+		if (static_cast<uint32_t>(__builtin_popcount(active & ~fading)) >= polyphony) {
+			Steal();
+		}
+
+		uint32_t slot;
+		const uint32_t free = ~active & slotMask;
+		if (free != 0) {
+			slot = __builtin_ctz(free);
+		} else {
+			slot = __builtin_ctz(fading);					// Polyphony is at most N - 1 so a full allocator has a fading voice
+			for (uint32_t s = slot + 1; s < N; ++s) {
+				if ((fading & (1UL << s)) && fadeLevel[s] < fadeLevel[slot]) {
+					slot = s;
+				}
+			}
+		}
+		restart = (fading & (1UL << slot)) != 0;
+
+		active |= (1UL << slot);
+		fading &= ~(1UL << slot);
+		order[slot] = ++noteCounter;
+		peak[slot] = 1.0f;
+		return slot;
+	}
+
+	void Release(const uint32_t slot)
+	{
+		active &= ~(1UL << slot);
+		fading &= ~(1UL << slot);
+	}
+
+	bool Fade(const uint32_t slot, float* outL, float* outR, const uint32_t frames)
+	{
+		// Apply fade out ramp to a stolen voice: returns true when the fade has completed and the voice can be stopped
+		float level = fadeLevel[slot];
+		uint32_t i = 0;
+		for (; i < frames && level > 0.0f; ++i) {
+			outL[i] *= level;
+			outR[i] *= level;
+			level -= fadeInc;
+		}
+		for (; i < frames; ++i) {
+			outL[i] = 0.0f;
+			outR[i] = 0.0f;
+		}
+		fadeLevel[slot] = level;
+		return level <= 0.0f;
+	}
+
+	template<typename RenderFn>
+	void RenderTail(const uint32_t slot, RenderFn render)
+	{
+		// A fading voice is being restarted: render(outL, outR, frames) must overwrite a block with the old voice's output. The
+		// rest of its fade is rendered ahead and summed into the tail buffer, which MixTail adds to the output over the next blocks
+		if (tailRead > 0) {
+			const uint32_t remaining = tailLength - tailRead;
+			std::copy(&tail[left][tailRead], &tail[left][tailLength], &tail[left][0]);
+			std::copy(&tail[right][tailRead], &tail[right][tailLength], &tail[right][0]);
+			tailLength = remaining;
+			tailRead = 0;
+		}
+		std::fill(&tail[left][tailLength], &tail[left][tailSize], 0.0f);
+		std::fill(&tail[right][tailLength], &tail[right][tailSize], 0.0f);
+
+		float blockL[audioBlockSize];
+		float blockR[audioBlockSize];
+		bool faded = false;
+		uint32_t pos = 0;
+		while (!faded && pos < tailSize) {
+			render(blockL, blockR, audioBlockSize);
+			faded = Fade(slot, blockL, blockR, audioBlockSize);
+			for (uint32_t i = 0; i < audioBlockSize; ++i) {
+				tail[left][pos + i] += blockL[i];
+				tail[right][pos + i] += blockR[i];
+			}
+			pos += audioBlockSize;
+		}
+		tailLength = std::max(tailLength, pos);
+	}
+
+	void MixTail(float* outL, float* outR, const uint32_t frames)
+	{
+		// Add the next frames of the rendered fade tail to the output
+		const uint32_t count = std::min(frames, tailLength - tailRead);
+		for (uint32_t i = 0; i < count; ++i) {
+			outL[i] += tail[left][tailRead + i];
+			outR[i] += tail[right][tailRead + i];
+		}
+		tailRead += count;
+		if (tailRead == tailLength) {
+			tailRead = 0;
+			tailLength = 0;
+		}
+	}
+
+	bool TailActive() const	{ return tailLength != 0; }
+	void ClearTail()		{ tailRead = 0; tailLength = 0; }
+
+	void SetPolyphony(const uint32_t voices)
+	{
+		polyphony = std::clamp<uint32_t>(voices, 1, maxPolyphony);
+	}
+
+private:
+	float tail[2][tailSize];								// Fade out of restarted voices rendered ahead of the output
+	uint32_t tailRead = 0;
+	uint32_t tailLength = 0;
+	uint32_t order[N];										// Note counter when each slot was started: used to find oldest voice
+	uint32_t noteCounter = 0;
+	float fadeLevel[N];
+
+	void Steal()
+	{
+		const uint32_t candidates = active & ~fading;
+		uint32_t victim = __builtin_ctz(candidates);
+		for (uint32_t slot = victim + 1; slot < N; ++slot) {
+			if (candidates & (1UL << slot)) {
+				const bool better = (stealMode == StealMode::quietest) ? peak[slot] < peak[victim] :
+									(noteCounter - order[slot]) > (noteCounter - order[victim]);
+				if (better) {
+					victim = slot;
+				}
+			}
+		}
+		fading |= (1UL << victim);
+		fadeLevel[victim] = 1.0f;
+	}
+};
+
+
+// Pool of preallocated instances of a drum voice: presents the same interface as a single voice so the voice manager can
+// treat it as one voice. Configuration is shared by all instances
+
+template<typename T, uint32_t N>
+class VoicePool final : public DrumVoice {
+public:
+	T voice[N];
+	VoiceAllocator<N> allocator;
+
+	void SetNoteMapper(NoteMapper* nm)
+	{
+		for (auto& v : voice) {
+			v.noteMapper = nm;
+		}
+	}
+
+	void Play(const uint8_t v, const uint32_t noteOffset, const uint32_t noteRange, const float velocity)
+	{
+		voice[Allocate()].Play(v, noteOffset, noteRange, velocity);
+		playing = true;
+	}
+
+	void Play(const uint8_t v, const uint32_t index)
+	{
+		voice[Allocate()].Play(v, index);
+		playing = true;
+	}
+
+	void Render(float* outL, float* outR, const uint32_t frames)
+	{
+		// First sounding voice renders directly into the output; remaining voices are rendered to a scratch buffer and added.
+		// Each instance writes its own level to the shared note mapper so the LED is set to the loudest after all are rendered
+		bool empty = true;
+		float ledLevel = 0.0f;
+		uint32_t slots = allocator.active;
+		while (slots != 0) {
+			const uint32_t slot = __builtin_ctz(slots);
+			slots &= slots - 1;
+
+			float* l = empty ? outL : scratch[left];
+			float* r = empty ? outR : scratch[right];
+			voice[slot].Render(l, r, frames);
+			ledLevel = std::max(ledLevel, voice[slot].noteMapper->ledLevel);
+
+			if ((allocator.fading & (1UL << slot)) && allocator.Fade(slot, l, r, frames)) {
+				voice[slot].Stop();
+			}
+
+			float peak = 0.0f;
+			if (empty) {
+				for (uint32_t i = 0; i < frames; ++i) {
+					peak = std::max(peak, std::abs(l[i]));
+				}
+			} else {
+				for (uint32_t i = 0; i < frames; ++i) {
+					outL[i] += l[i];
+					outR[i] += r[i];
+					peak = std::max(peak, std::abs(l[i]));
+				}
+			}
+			allocator.peak[slot] = peak;
+			empty = false;
+
+			if (!voice[slot].playing) {
+				allocator.Release(slot);
+			}
+		}
+
+		if (empty) {
+			std::fill(outL, outL + frames, 0.0f);
+			std::fill(outR, outR + frames, 0.0f);
+		} else {
+			voice[0].noteMapper->ledLevel = ledLevel;
+		}
+		allocator.MixTail(outL, outR, frames);
+		playing = (allocator.active != 0) || allocator.TailActive();
+	}
+
+	void Stop()
+	{
+		for (auto& v : voice) {
+			if (v.playing) {
+				v.Stop();
+			}
+		}
+		allocator.active = 0;
+		allocator.fading = 0;
+		allocator.ClearTail();
+		playing = false;
+	}
+
+	void UpdateFilter()
+	{
+		for (auto& v : voice) {
+			v.UpdateFilter();
+		}
+	}
+
+	uint32_t SerialiseConfig(uint8_t** buff, const uint8_t voiceIndex)
+	{
+		return voice[0].SerialiseConfig(buff, voiceIndex);
+	}
+
+	void StoreConfig(uint8_t* buff, const uint32_t len)
+	{
+		for (auto& v : voice) {
+			v.StoreConfig(buff, len);
+		}
+	}
+
+	uint32_t ConfigSize()
+	{
+		return voice[0].ConfigSize();
+	}
+
+private:
+	float scratch[2][audioBlockSize];
+
+	uint32_t Allocate()
+	{
+		const uint32_t slot = allocator.Allocate();
+		if (allocator.restart) {
+			allocator.RenderTail(slot, [&](float* outL, float* outR, const uint32_t frames) {
+				voice[slot].Render(outL, outR, frames);
+			});
+			voice[slot].Stop();
+		}
+		return slot;
+	}
+};
@@ -1,17 +1,29 @@
 #include "Claps.h"
 #include "VoiceManager.h"
+#include "NoiseGenerator.h"
 
 void Claps::Play(const uint8_t voice, const uint32_t noteOffset, uint32_t noteRange, const float velocity)
 {
 	playing = true;
 
 	velocityScale = velocity;
-	level = config.initLevel;
-	state = State::hit1;
-	stateCounter = 0;
+
+	using Curve = EnvSegment::Curve;
+#ifdef DEBUGFILTER			// will just output filtered white noise for a few seconds to allow frequency analysis of filter
+	envelope.segment[hit1]		= {Curve::linear, 0.0f, 0.0f, 0.0f, 1000000, config.initLevel};
+	envelope.Start(1);
+#else
+	// Each hit lasts a fixed number of samples, restarting from the initial level
+	const float initDecay = DecayRate(config.initDecay);
+	envelope.segment[hit1]		= {Curve::exponential, initDecay, 0.0f, 0.0f, static_cast<uint32_t>(460 * sampleRateScale), config.initLevel};		// approx 9.6ms
+	envelope.segment[hit2]		= {Curve::exponential, initDecay, 0.0f, 0.0f, static_cast<uint32_t>(547 * sampleRateScale), config.initLevel};		// approx 11.4ms
+	envelope.segment[hit3]		= {Curve::exponential, initDecay, 0.0f, 0.0f, static_cast<uint32_t>(336 * sampleRateScale), config.initLevel};		// approx 7ms
+	envelope.segment[reverb]	= {Curve::exponential, DecayRate(config.reverbDecay), 0.0f, 0.00001f, 0, config.reverbInitLevel};
+	envelope.Start(stateCount);
+#endif
 
 	const float omega = 2.0f * config.filterCutoff / systemSampleRate;		// omega = cutoff in Hz / half sampling frequency
-	filter.CalcCoeff(omega, config.filterQ);
+	filter.SetCutoff(omega, config.filterQ);
 }
 
 
@@ -22,58 +34,39 @@ void Claps::Play(const uint8_t voice, const uint32_t index)
 }
 
 
-void Claps::CalcOutput()
+void Claps::Render(float* outL, float* outR, const uint32_t frames)
 {
-	if (playing) {
-		float output = intToFloatMult * static_cast<int32_t>(RNG->DR);		// Initial random number used for noise
-		output = filter.FilterSample(output, iirReg);
-
-		++stateCounter;
-
-#ifdef DEBUGFILTER			// will just output filtered white noise for a few seconds to allow frequency analysis of filter
-	if (stateCounter == 1000000) {
-		playing = false;
+	if (!playing) {
+		std::fill(outL, outL + frames, 0.0f);
+		std::fill(outR, outR + frames, 0.0f);
+		return;
 	}
 
+	const float scale = velocityScale;
+	const uint32_t active = envelope.Render(outL, frames);
+
+	// Filtered noise has some additional non-filtered noise added back in
+	noiseGenerator.Fill(outR, active);
+	filter.Process(outR, active, left);
+	float unfiltered[audioBlockSize];
+#ifdef DEBUGFILTER
+	std::fill(unfiltered, &unfiltered[active], 0.0f);
 #else
-		switch (state) {
-		case State::hit1:
-			if (stateCounter > 460) {		// approx 9.6ms
-				level = config.initLevel;
-				stateCounter = 0;
-				state = State::hit2;
-			}
-			break;
-		case State::hit2:
-			if (stateCounter > 547) {		// approx 11.4ms
-				level = config.initLevel;
-				stateCounter = 0;
-				state = State::hit3;
-			}
-			break;
-		case State::hit3:
-			if (stateCounter > 336) {		// approx 7ms
-				level = config.reverbInitLevel;
-				stateCounter = 0;
-				state = State::reverb;
-			}
-			break;
-		default:
-			break;
-		}
-
-		output += config.unfilteredNoiseLevel * intToFloatMult * static_cast<int32_t>(RNG->DR);		// Add some additional non-filtered noise back in
-
-		level *= (state == State::reverb ? config.reverbDecay : config.initDecay);
+	noiseGenerator.Fill(unfiltered, active, config.unfilteredNoiseLevel);
 #endif
-		outputLevel[left]  = velocityScale * (output * level);
-		outputLevel[right] = outputLevel[left];
-
-		if (level < 0.00001f && state == State::reverb) {
-			playing = false;
-		}
 
+	uint32_t i = 0;
+	for (; i < active; ++i) {
+		const float output = outR[i] + unfiltered[i];
+		outL[i] = scale * (output * outL[i]);
+		outR[i] = outL[i];
 	}
+	for (; i < frames; ++i) {
+		outL[i] = 0.0f;
+		outR[i] = 0.0f;
+	}
+
+	playing = envelope.Active();
 }
 
 
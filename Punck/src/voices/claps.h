@@ -1,17 +1,18 @@
 #pragma once
 #include "initialisation.h"
 #include "DrumVoice.h"
-#include "Filter.h"
+#include "SVFilter.h"
+#include "Envelope.h"
 
 class NoteMapper;
 
 
 
-class Claps : public DrumVoice {
+class Claps final : public DrumVoice {
 public:
 	void Play(const uint8_t voice, const uint32_t noteOffset, uint32_t noteRange, const float velocity);
 	void Play(const uint8_t voice, const uint32_t index);
-	void CalcOutput();
+	void Render(float* outL, float* outR, const uint32_t frames);
 	void UpdateFilter();
 	uint32_t SerialiseConfig(uint8_t** buff, const uint8_t voiceIndex);
 	void StoreConfig(uint8_t* buff, const uint32_t len);
@@ -20,12 +21,10 @@ public:
 	NoteMapper* noteMapper;
 private:
 
-	float level;
 	float velocityScale;
 
-	enum class State {hit1, hit2, hit3, reverb};
-	State state;
-	uint32_t stateCounter;
+	enum State : uint8_t {hit1, hit2, hit3, reverb, stateCount};
+	Envelope<stateCount> envelope;					// Three short hits then a longer 'reverb' tail
 
 	struct Config {
 		float initLevel = 5.0f;
@@ -38,7 +37,6 @@ private:
 	} config;
 
 
-	IIRFilter<2> filter{filterPass::BandPass};		// Band pass filter
-	IIRRegisters<2> iirReg;
+	SVFilter<filterPass::BandPass> filter{nullptr};	// Band pass filter
 };
 
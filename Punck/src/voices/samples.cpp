@@ -2,38 +2,57 @@
 #include "samples.h"
 #include "FatTools.h"
 #include "VoiceManager.h"
+#include "NoiseGenerator.h"
 #include <cstring>
 #include <cmath>
 
 
 Samples::Samples()
 {
-	sampler[playerA].voiceADC = &ADC_array[ADC_SampleAVoice];
-	sampler[playerB].voiceADC = &ADC_array[ADC_SampleBVoice];
-	sampler[playerA].tuningADC = &ADC_array[ADC_SampleASpeed];
-	sampler[playerB].tuningADC = &ADC_array[ADC_SampleBSpeed];
-	sampler[playerA].levelADC = &ADC_array[ADC_SampleALevel];
-	sampler[playerB].levelADC = &ADC_array[ADC_SampleBLevel];
+	sampler[playerA].voiceADC = &controlADC[ADC_SampleAVoice];
+	sampler[playerB].voiceADC = &controlADC[ADC_SampleBVoice];
+	sampler[playerA].tuningADC = &controlADC[ADC_SampleASpeed];
+	sampler[playerB].tuningADC = &controlADC[ADC_SampleBSpeed];
+	sampler[playerA].levelADC = &controlADC[ADC_SampleALevel];
+	sampler[playerB].levelADC = &controlADC[ADC_SampleBLevel];
+
+	// Samples are mixed directly into the output so there is no level measurement for the quietest voice
+	sampler[playerA].allocator.stealMode = VoiceAllocator<maxSampleVoices>::StealMode::oldest;
+	sampler[playerB].allocator.stealMode = VoiceAllocator<maxSampleVoices>::StealMode::oldest;
 }
 
 
 void Samples::Play(const uint8_t sp, uint32_t noteOffset, const uint32_t noteRange, const float velocity)
 {
-	if (fatTools.noFileSystem || (sampler[sp].bankLen == 0)) {
+	Sampler& s = sampler[sp];
+	if (fatTools.noFileSystem || (s.bankLen == 0)) {
 		return;
 	}
-	sampler[sp].playing = true;
+	s.playing = true;
 
 	// Get sample from sorted bank list based on player and note offset
-	if (noteOffset == sampler[sp].bankLen && sampler[sp].bankLen > 1) {		// Random mode
-		noteOffset = RNG->DR % (sampler[sp].bankLen - 1);
+	if (noteOffset == s.bankLen && s.bankLen > 1) {							// Random mode
+		noteOffset = noiseGenerator.NextInt() % (s.bankLen - 1);
 	} else {
-		noteOffset = (noteOffset < sampler[sp].bankLen) ? noteOffset : 0;	// If no sample at index use first sample in bank
+		noteOffset = (noteOffset < s.bankLen) ? noteOffset : 0;				// If no sample at index use first sample in bank
 	}
-	sampler[sp].sample = sampler[sp].bank[noteOffset].s;
-	sampler[sp].sampleAddress = sampler[sp].sample->startAddr;
-	sampler[sp].playbackSpeed = static_cast<float>(sampler[sp].sample->sampleRate) / systemSampleRate;
-	sampler[sp].velocityScale = sampler[sp].sample->volume * velocity * (static_cast<float>(*sampler[sp].levelADC) / 32768.0f);
+
+	// Allocate a voice from the player so a new sample does not cut off previous samples still sounding
+	const uint32_t slot = s.allocator.Allocate();
+	SampleVoice& v = s.voice[slot];
+	if (s.allocator.restart && v.playing && extFlash.memMapMode) {
+		s.allocator.RenderTail(slot, [&](float* outL, float* outR, const uint32_t frames) {
+			std::fill(outL, outL + frames, 0.0f);
+			std::fill(outR, outR + frames, 0.0f);
+			RenderVoice(s, v, outL, outR, frames);
+		});
+	}
+	v.playing = true;
+	v.sample = s.bank[noteOffset].s;
+	v.sampleAddress = v.sample->startAddr;
+	v.fractionalPosition = 0.0f;
+	v.playbackSpeed = static_cast<float>(v.sample->sampleRate) / systemSampleRate;
+	v.velocityScale = v.sample->volume * velocity * (static_cast<float>(*s.levelADC) / 32768.0f);
 }
 
 
@@ -46,79 +65,190 @@ void Samples::Play(const uint8_t sp, uint32_t index)
 }
 
 
-static inline int32_t readBytes(const uint8_t* address, const uint8_t bytes, const uint16_t format)
+template <uint8_t bytes, bool floatFormat>
+static inline int32_t readBytes(const uint8_t* address)
 {
-	if (!extFlash.memMapMode) {					// If writing to flash attempting to read memory mapped data will hard fault
-		return 0;
-	}
-
 	// where data size is less than 32 bit, shift left to zero out lower bytes
-	switch (bytes) {
-	case 1:										// 8 bit data
+	if constexpr (bytes == 1) {					// 8 bit data
 		return (uint32_t)(*(uint8_t*)address << 24);
-	case 2:										// 16 bit data
+	} else if constexpr (bytes == 2) {			// 16 bit data
 		return *(uint16_t*)address << 16;
-	case 3:										// 24 bit data: Read in 32 bits and shift up 8 bits to make 32 bit value with lower byte zeroed
+	} else if constexpr (bytes == 3) {			// 24 bit data: Read in 32 bits and shift up 8 bits to make 32 bit value with lower byte zeroed
 		return *(uint32_t*)address << 8;
-	case 4:
-		if (format == 3) {						// 1 = PCM integer; 3 = float
-			return (uint32_t)(*(float*)address * floatToIntMult);
+	} else if constexpr (floatFormat) {			// 32 bit float
+		return (uint32_t)(*(float*)address * floatToIntMult);
+	} else {
+		return *(uint32_t*)address;				// 32 bit data
+	}
+}
+
+
+template <uint8_t bytes, bool floatFormat>
+void Samples::RenderFormat(Sampler& sp, SampleVoice& v, float* outL, float* outR, const uint32_t frames)
+{
+	if (interpolation == Interpolation::linear && !interpolationSuspended) {
+		RenderSampler<bytes, floatFormat, true>(sp, v, outL, outR, frames);
+	} else {
+		RenderSampler<bytes, floatFormat, false>(sp, v, outL, outR, frames);
+	}
+}
+
+
+template <uint8_t bytes, bool floatFormat, bool interpolate>
+void Samples::RenderSampler(Sampler& sp, SampleVoice& v, float* outL, float* outR, const uint32_t frames)
+{
+	// Sample format is a template parameter so the read is resolved outside the inner loop
+	const uint8_t* address = v.sampleAddress;
+	const uint8_t* endAddr = v.sample->endAddr;
+	const uint32_t frameBytes = v.sample->channels * bytes;
+	const uint32_t rightOffset = (v.sample->channels == 2) ? bytes : 0;	// Mono samples duplicate left channel to right
+	const float scale = intToFloatMult * v.velocityScale;
+
+	// Get sample speed from ADC - want range 0.5 - 1.5
+	const float adjSpeed = 0.5f + static_cast<float>(*sp.tuningADC) / 65536.0f;
+	const float speed = adjSpeed * v.playbackSpeed;
+	float fractionalPosition = v.fractionalPosition;
+
+	for (uint32_t i = 0; i < frames; ++i) {
+		if constexpr (interpolate) {
+			// Linear interpolation between current and next frame using the fractional position
+			const float l0 = readBytes<bytes, floatFormat>(address);
+			const float r0 = readBytes<bytes, floatFormat>(address + rightOffset);
+			const float l1 = readBytes<bytes, floatFormat>(address + frameBytes);
+			const float r1 = readBytes<bytes, floatFormat>(address + frameBytes + rightOffset);
+			outL[i] += scale * (l0 + fractionalPosition * (l1 - l0));
+			outR[i] += scale * (r0 + fractionalPosition * (r1 - r0));
 		} else {
-			return *(uint32_t*)address;			// 32 bit data
+			outL[i] += scale * readBytes<bytes, floatFormat>(address);
+			outR[i] += scale * readBytes<bytes, floatFormat>(address + rightOffset);
+		}
+
+		// Split the next position into an integer jump and fractional position
+		fractionalPosition += speed;
+		const uint32_t addressJump = static_cast<uint32_t>(fractionalPosition);
+		fractionalPosition -= addressJump;
+		address += frameBytes * addressJump;
+
+		if (address > endAddr) {
+			v.playing = false;
+			break;
 		}
-	default:
-		return 0;
 	}
+
+	v.sampleAddress = address;
+	v.fractionalPosition = fractionalPosition;
 }
 
 
-void Samples::CalcOutput()
+void Samples::Render(float* outL, float* outR, const uint32_t frames)
 {
-	playing = (sampler[playerA].playing || sampler[playerB].playing);
+	// Render both players into the same output
+	std::fill(outL, outL + frames, 0.0f);
+	std::fill(outR, outR + frames, 0.0f);
+
 	for (auto& sp : sampler) {
-		if (sp.playing) {
-			auto& bytes = sp.sample->byteDepth;
+		AddPlayer(sp, outL, outR, frames);
+	}
 
-			sp.currentSamples[left] = readBytes(sp.sampleAddress, bytes, sp.sample->dataFormat);
+	playing = (sampler[playerA].playing || sampler[playerB].playing);
+}
 
-			if (sp.sample->channels == 2) {
-				sp.currentSamples[right] = readBytes(sp.sampleAddress + bytes, bytes, sp.sample->dataFormat);
-			} else {
-				sp.currentSamples[right] = sp.currentSamples[left];		// Duplicate left channel to right for mono signal
-			}
 
-			// Get sample speed from ADC - want range 0.5 - 1.5
-			const float adjSpeed = 0.5f + static_cast<float>(*sp.tuningADC) / 65536.0f;
-
-			// Split the next position into an integer jump and fractional position
-			float addressJump;			// Integral part of position
-			sp.fractionalPosition = std::modf(sp.fractionalPosition + (adjSpeed * sp.playbackSpeed), &addressJump);
-			sp.sampleAddress += (sp.sample->channels * bytes * (uint32_t)addressJump);
-
-			if ((uint8_t*)sp.sampleAddress > sp.sample->endAddr) {
-				sp.currentSamples[left] = 0;
-				sp.currentSamples[right] = 0;
-				sp.playing = false;
-				sp.noteMapper->pwmLed.Level(0.0f);
-			} else {
-				// Apply fade out to led based on position in sample
-				const float samplePos = (float)((uint32_t)(sp.sampleAddress - sp.sample->startAddr));
-				sp.noteMapper->pwmLed.Level(1.0f - samplePos / sp.sample->dataSize);		// FIXME - could precompute 1 / dataSize and use multiply instead of divide
+void Samples::RenderPlayer(const uint8_t player, float* outL, float* outR, const uint32_t frames)
+{
+	// Render a single player so each can be mixed to its own mixer channel
+	std::fill(outL, outL + frames, 0.0f);
+	std::fill(outR, outR + frames, 0.0f);
+
+	AddPlayer(sampler[player], outL, outR, frames);
+
+	playing = (sampler[playerA].playing || sampler[playerB].playing);
+}
+
+
+void Samples::AddPlayer(Sampler& sp, float* outL, float* outR, const uint32_t frames)
+{
+	// If writing to flash attempting to read memory mapped data will hard fault
+	if (!sp.playing || !extFlash.memMapMode) {
+		return;
+	}
+	sp.allocator.MixTail(outL, outR, frames);
+
+	float ledLevel = 0.0f;
+	uint32_t slots = sp.allocator.active;
+	while (slots != 0) {
+		const uint32_t slot = __builtin_ctz(slots);
+		slots &= slots - 1;
+		SampleVoice& v = sp.voice[slot];
+
+		if (sp.allocator.fading & (1UL << slot)) {
+			// Voice has been stolen: render separately so it can be faded out before being added to the output
+			std::fill(&fadeBuffer[left][0], &fadeBuffer[left][0] + audioBlockSize * 2, 0.0f);
+			RenderVoice(sp, v, fadeBuffer[left], fadeBuffer[right], frames);
+			if (sp.allocator.Fade(slot, fadeBuffer[left], fadeBuffer[right], frames)) {
+				v.playing = false;
+			}
+			for (uint32_t i = 0; i < frames; ++i) {
+				outL[i] += fadeBuffer[left][i];
+				outR[i] += fadeBuffer[right][i];
 			}
+		} else {
+			RenderVoice(sp, v, outL, outR, frames);
+		}
+
+		if (v.playing) {
+			// Apply fade out to led based on position in sample
+			const float samplePos = (float)((uint32_t)(v.sampleAddress - v.sample->startAddr));
+			ledLevel = std::max(ledLevel, 1.0f - samplePos / v.sample->dataSize);
+		} else {
+			sp.allocator.Release(slot);
+		}
+	}
 
+	sp.playing = (sp.allocator.active != 0) || sp.allocator.TailActive();
+	sp.noteMapper->ledLevel = ledLevel;
+}
+
+
+void Samples::RenderVoice(Sampler& sp, SampleVoice& v, float* outL, float* outR, const uint32_t frames)
+{
+	switch (v.sample->byteDepth) {
+	case 1:
+		RenderFormat<1, false>(sp, v, outL, outR, frames);
+		break;
+	case 2:
+		RenderFormat<2, false>(sp, v, outL, outR, frames);
+		break;
+	case 3:
+		RenderFormat<3, false>(sp, v, outL, outR, frames);
+		break;
+	case 4:
+		if (v.sample->dataFormat == 3) {			// 1 = PCM integer; 3 = float
+			RenderFormat<4, true>(sp, v, outL, outR, frames);
+		} else {
+			RenderFormat<4, false>(sp, v, outL, outR, frames);
 		}
+		break;
+	default:
+		v.playing = false;
+		break;
 	}
+}
 
-	if (playing) {
-		// Mix samples for final output to DAC
-		outputLevel[left] = intToFloatMult *
-				(sampler[playerA].velocityScale * sampler[playerA].currentSamples[left] +
-				 sampler[playerB].velocityScale * sampler[playerB].currentSamples[left]);
 
-		outputLevel[right] = intToFloatMult *
-				(sampler[playerA].velocityScale * sampler[playerA].currentSamples[right] +
-				 sampler[playerB].velocityScale * sampler[playerB].currentSamples[right]);
+void Samples::Stop()
+{
+	for (auto& sp : sampler) {
+		for (auto& v : sp.voice) {
+			v.playing = false;
+		}
+		sp.allocator.active = 0;
+		sp.allocator.fading = 0;
+		sp.allocator.ClearTail();
+		sp.playing = false;
+		sp.noteMapper->ledLevel = 0.0f;
 	}
+	playing = false;
 }
 
 
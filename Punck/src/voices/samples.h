@@ -2,14 +2,16 @@
 
 #include "initialisation.h"
 #include "DrumVoice.h"
+#include "VoicePool.h"
 #include <string>
 #include <array>
 
 class NoteMapper;
 
-class Samples : public DrumVoice {
+class Samples final : public DrumVoice {
 public:
 	enum SamplePlayer {playerA, playerB, noPlayer};
+	enum class Interpolation {none, linear};
 
 	struct Sample {
 		char name[11];
@@ -35,26 +37,38 @@ public:
 		uint32_t index;
 	};
 
-	struct Sampler {
+	static constexpr uint32_t maxSampleVoices = 4;		// Voices per player: allows polyphony of 3 plus a slot to fade out a stolen sample
+
+	struct SampleVoice {
 		bool playing = false;
 		Sample* sample;
 		const uint8_t* sampleAddress;
 		float playbackSpeed;				// Multiplier to allow faster or slow playback (and compensate for non 48k samples)
 		float fractionalPosition;			// When playing sample at varying rate store how far through the current sample playback is
-		int32_t currentSamples[2] = {};		// Left/right sample levels for mixing
+		float velocityScale;
+	};
+
+	struct Sampler {
+		bool playing = false;				// Set when any of the player's voices is playing
 		uint32_t bankLen;					// Number of samples in bank
 		std::array<Bank, 40> bank;			// Store pointer to Bank samples sorted by index
 		NoteMapper* noteMapper;
-		float velocityScale;
 		volatile uint16_t* voiceADC;
 		volatile uint16_t* tuningADC;
 		volatile uint16_t* levelADC;
+		SampleVoice voice[maxSampleVoices];
+		VoiceAllocator<maxSampleVoices> allocator;
 	} sampler[2];
 
+	Interpolation interpolation = Interpolation::none;		// Linear reduces aliasing at fractional speeds at extra CPU cost
+	bool interpolationSuspended = false;					// Set by the CPU governor when short of processing time
+
 	Samples();
 	void Play(const uint8_t player, const uint32_t noteOffset, uint32_t noteRange, const float velocity);
 	void Play(const uint8_t player, const uint32_t sampleNo);
-	void CalcOutput();
+	void Render(float* outL, float* outR, const uint32_t frames);
+	void RenderPlayer(const uint8_t player, float* outL, float* outR, const uint32_t frames);
+	void Stop();
 	bool UpdateSampleList();
 	uint32_t SerialiseSampleNames(uint8_t** buff, const uint8_t voiceIndex);
 	uint32_t SerialiseConfig(uint8_t** buff, const uint8_t voiceIndex);
@@ -65,6 +79,12 @@ private:
 	char longFileName[100];
 	uint8_t lfnPosition = 0;
 	bool GetSampleInfo(Sample* sample);
+	void AddPlayer(Sampler& sp, float* outL, float* outR, const uint32_t frames);
+	void RenderVoice(Sampler& sp, SampleVoice& v, float* outL, float* outR, const uint32_t frames);
+	template <uint8_t bytes, bool floatFormat> void RenderFormat(Sampler& sp, SampleVoice& v, float* outL, float* outR, const uint32_t frames);
+	template <uint8_t bytes, bool floatFormat, bool interpolate> void RenderSampler(Sampler& sp, SampleVoice& v, float* outL, float* outR, const uint32_t frames);
+
+	float fadeBuffer[2][audioBlockSize];				// Stolen voices are rendered here so a fade out can be applied
 	int32_t ParseInt(const std::string_view cmd, const std::string_view precedingChar, const int32_t low = 0, const int32_t high = 0);
 };
 
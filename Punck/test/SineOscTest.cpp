@@ -0,0 +1,41 @@
+// Host accuracy check of SineOsc against std::sin. Build and run on the host from the Punck directory with `make -C test`
+
+#include "voices/SineOsc.h"
+#include <cstdio>
+
+static constexpr double maxError = 4.8e-6;					// Documented bound in SineOsc.h
+
+int main()
+{
+	// Run the oscillator for a full cycle at increments from a low kick pitch to several kHz, plus an increment that is not a
+	// factor of the cycle so every table interval is sampled at many different fractions
+	const float frequencies[] = {20.0f, 55.5f, 440.0f, 1234.5f, 8000.0f};
+	double worst = 0.0;
+	bool passed = true;
+
+	for (const float freq : frequencies) {
+		const float inc = SineOsc::PhaseInc(2.0 * pi * freq / systemSampleRate);
+		const uint64_t steps = static_cast<uint64_t>(4294967296.0 / static_cast<uint32_t>(inc)) + 1;
+		uint32_t phase = 0;
+		double error = 0.0;
+		for (uint64_t i = 0; i < steps; ++i) {
+			const float out = SineOsc::Next(phase, inc);
+			error = std::max(error, std::abs(out - std::sin(2.0 * pi * phase / 4294967296.0)));
+		}
+		printf("%8.1fHz: max error %.3e\n", freq, error);
+		worst = std::max(worst, error);
+		passed = passed && error <= maxError;
+	}
+
+	// Sample every 997th phase value across the whole 32 bit range
+	double error = 0.0;
+	for (uint64_t phase = 0; phase < 4294967296; phase += 997) {
+		error = std::max(error, std::abs(SineOsc::Sine(static_cast<uint32_t>(phase)) - std::sin(2.0 * pi * phase / 4294967296.0)));
+	}
+	printf("Full range: max error %.3e\n", error);
+	worst = std::max(worst, error);
+	passed = passed && error <= maxError;
+
+	printf("%s: worst error %.3e (%.1fdB), bound %.1e\n", passed ? "PASS" : "FAIL", worst, 20.0 * std::log10(worst), maxError);
+	return passed ? 0 : 1;
+}
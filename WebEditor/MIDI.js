@@ -12,11 +12,11 @@ var i2sUnderrun = 0;		// Debug for missed samples
 
 // enum from c++ code to match voice
 var voiceEnum = {
-    Kick: 0, Snare: 1, HiHat: 2, Sampler_A: 3, Sampler_B: 4, Toms: 5, Claps: 6
+    Kick: 0, Snare: 1, HiHat: 2, Sampler_A: 3, Sampler_B: 4, Toms: 5, Claps: 6, Ride: 7
 };
 
 var requestEnum = {
-    StartStop: 0x1A, GetSequence: 0x1B, SetSequence: 0x1C, GetVoiceConfig: 0x1D, SetVoiceConfig: 0x1E, GetSamples: 0x1F, GetStatus: 0x20, SaveConfig: 0x21, GetReverbConfig: 0x22, SetReverbConfig: 0x23
+    StartStop: 0x1A, GetSequence: 0x1B, SetSequence: 0x1C, GetVoiceConfig: 0x1D, SetVoiceConfig: 0x1E, GetSamples: 0x1F, GetStatus: 0x20, SaveConfig: 0x21, GetReverbConfig: 0x22, SetReverbConfig: 0x23, GetMixerConfig: 0x24, SetMixerConfig: 0x25
 };
 
 
@@ -106,13 +106,64 @@ var clapSettings = [
 	{name: 'Unfiltered Noise Level'},
 ];
 
+var rideSettings = [
+	{name: 'Attack'},
+	{name: 'Decay'},
+	{name: 'Level'},
+
+	{name: 'Base Frequency'},
+	{name: 'HP Cutoff'},
+	{name: 'LP Initial Cutoff'},
+	{name: 'LP Final Cutoff'},
+	{name: 'LP Cutoff  Inc'},
+
+	{name: 'Noise level'},
+	{name: 'Noise Decay'},
+
+	{name: 'Partial 0 Level'},
+	{name: 'Partial 1 Level'},
+	{name: 'Partial 2 Level'},
+	{name: 'Partial 3 Level'},
+	{name: 'Partial 4 Level'},
+	{name: 'Partial 5 Level'},
+	{name: 'Partial 6 Level'},
+	{name: 'Partial 7 Level'},
+	{name: 'Partial 8 Level'},
+	{name: 'Partial 9 Level'},
+	{name: 'Partial 10 Level'},
+	{name: 'Partial 11 Level'},
+
+	{name: 'Partial 0 Ratio'},
+	{name: 'Partial 1 Ratio'},
+	{name: 'Partial 2 Ratio'},
+	{name: 'Partial 3 Ratio'},
+	{name: 'Partial 4 Ratio'},
+	{name: 'Partial 5 Ratio'},
+	{name: 'Partial 6 Ratio'},
+	{name: 'Partial 7 Ratio'},
+	{name: 'Partial 8 Ratio'},
+	{name: 'Partial 9 Ratio'},
+	{name: 'Partial 10 Ratio'},
+	{name: 'Partial 11 Ratio'},
+];
+
 
 var reverbSettings = [
 	{name: 'Reverb Level'},
 	{name: 'Mixer Base Delay'},
 	{name: 'Diffuser Count 0-3'},
 	{name: 'Mixer Channels 0/4/8'},
-	{name: 'Filter Cutoff Hz'},
+	{name: 'Filter Cutoff Hz 100-7200'},
+	{name: 'Silence Threshold dBFS'},
+];
+
+
+// Mixer channels in firmware voice order; each channel has level, pan and reverb send
+var mixerChannels = ['Kick', 'Snare', 'HiHat', 'Sampler A', 'Sampler B', 'Toms', 'Claps', 'Ride'];
+var mixerSettings = [
+	{name: 'Level 0-2'},
+	{name: 'Pan 0-1'},
+	{name: 'Reverb Send 0-1'},
 ];
 
 
@@ -133,6 +184,7 @@ var drumSettings = [
 	{heading: "Hihat Settings", id: voiceEnum.HiHat, settings: hihatSettings},
 	{heading: "Toms Settings", id: voiceEnum.Toms, settings: tomsSettings},
 	{heading: "Clap Settings", id: voiceEnum.Claps, settings: clapSettings},
+	{heading: "Ride Settings", id: voiceEnum.Ride, settings: rideSettings},
 ]
 
 // Settings related to drum sequence editing
@@ -318,6 +370,7 @@ function afterLoad()
 	}
 	html += `&nbsp;&nbsp;<button id="btnEditConfig" class="topcoat-button-bar__button--large" onclick="RefreshConfig();" style="background-color: rgb(74, 77, 78)">Drum Settings</button>
 			 &nbsp;&nbsp;<button id="btnReverb" class="topcoat-button-bar__button--large" onclick="RefreshReverb();" style="background-color: rgb(74, 77, 78)">Reverb Settings</button>
+			 &nbsp;&nbsp;<button id="btnMixer" class="topcoat-button-bar__button--large" onclick="RefreshMixer();" style="background-color: rgb(74, 77, 78)">Mixer Settings</button>
 		</div>`;
 	document.getElementById("buttonBar").innerHTML = html;
 	ClearButtonBar();
@@ -349,6 +402,7 @@ function ClearButtonBar()
 	document.getElementById(`btnSeq${seqSettings.seq}`).style.color = "rgb(125, 206, 115)";
 	document.getElementById(`btnEditConfig`).style.backgroundColor = "rgb(74, 77, 78)";
 	document.getElementById(`btnReverb`).style.backgroundColor = "rgb(74, 77, 78)";
+	document.getElementById(`btnMixer`).style.backgroundColor = "rgb(74, 77, 78)";
 }
 
 
@@ -388,6 +442,29 @@ function BuildReverbHtml()
 	document.getElementById(`btnReverb`).style.backgroundColor = "#737373";
 }
 
+
+function BuildMixerHtml()
+{
+	// Build html grid of level, pan and send settings for each mixer channel
+	var html = '<div style="display: grid; grid-template-columns: 150px 100px 100px 100px; padding: 10px; border: 1px solid rgba(0, 0, 0, 0.3);">';
+	html += '<div class="grid-container3"></div>';
+	for (var s = 0; s < mixerSettings.length; s++) {
+		html += `<div class="grid-container3">${mixerSettings[s].name}</div>`;
+	}
+	for (var c = 0; c < mixerChannels.length; c++) {
+		html += `<div class="grid-container3">${mixerChannels[c]}</div>`;
+		for (var s = 0; s < mixerSettings.length; s++) {
+			html += `<div class="grid-container3"><input type="text" id="mixerSettings${c}${s}" onchange="updateMixer();"></div>`;
+		}
+	}
+	html += '</div>'
+
+	document.getElementById("drumEditor").innerHTML = html;
+
+	ClearButtonBar();
+	document.getElementById(`btnMixer`).style.backgroundColor = "#737373";
+}
+
 function BeatGotFocus(button)
 {
 	// Clear border of previously selected note
@@ -699,6 +776,13 @@ function RefreshReverb()
     output.send(message);
 }
 
+function RefreshMixer()
+{
+	var message = [0xF0, requestEnum.GetMixerConfig, 0, 0xF7];
+	PrintMessage(message);			// Print contents of payload to console
+    output.send(message);
+}
+
 
 
 function RequestSamples(bank)
@@ -914,6 +998,23 @@ function getMIDIMessage(midiMessage)
 				}
 
 				break;
+
+			case requestEnum.GetMixerConfig:
+				var sysEx = DecodeSysEx(midiMessage.data, 2);		// 2 is length of header
+				PrintMessage(sysEx, true);							// Print contents of payload to console
+
+				BuildMixerHtml();
+
+				// Store the values encoded in the SysEx data into the html fields
+				var pos = 0;
+				for (var c = 0; c < mixerChannels.length; c++) {
+					for (var s = 0; s < mixerSettings.length; s++) {
+						document.getElementById(`mixerSettings${c}${s}`).value = BytesToFloat(sysEx.slice(pos, pos + 4));
+						pos += 4;
+					}
+				}
+
+				break;
 	
 			}
 	}
@@ -1004,6 +1105,40 @@ function updateReverb()
 }
 
 
+function updateMixer()
+{
+	// Copy the values of the html fields into a float array for serialisation
+	var floatArray = new Float32Array(mixerChannels.length * mixerSettings.length)
+	for (var c = 0; c < mixerChannels.length; c++) {
+		for (var s = 0; s < mixerSettings.length; s++) {
+			floatArray[c * mixerSettings.length + s] = document.getElementById(`mixerSettings${c}${s}`).value;
+		}
+	}
+    var byteArray = new Uint8Array(floatArray.buffer);   			// use the buffer of Float32Array view
+
+    // Convert to sysex information
+    var message = new Uint8Array(3 + (byteArray.length * 2));
+    message[0] = 0xF0;
+    message[1] = requestEnum.SetMixerConfig;                        // Set config command
+    var msgPos = 2;
+
+	// Since the upper bit of a sysex byte cannot be set, split each byte into an upper and lower nibble for transmission
+	var lowerNibble = true;
+    for (i = 0; i < byteArray.length * 2; ++i) {
+		if (lowerNibble) {
+			message[msgPos++] = byteArray[Math.trunc(i / 2)] & 0xF;
+		} else {
+			message[msgPos++] = byteArray[Math.trunc(i / 2)] >> 4;
+		}
+        lowerNibble = !lowerNibble;
+    }
+    message[msgPos] = 0xF7;
+
+	PrintMessage(message);			// Print contents of payload to console
+    output.send(message);
+}
+
+
 // Sends MIDI note to requested channel
 function sendNote(noteValue, channel)
 {